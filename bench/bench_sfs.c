@@ -0,0 +1,283 @@
+/* bench_sfs.c: SimpleFS benchmark suite
+ *
+ * Drives the libsfs.a API directly against a scratch disk image and reports
+ * throughput, operation rates, and p50/p99 latency in CSV form:
+ *
+ *      benchmark,parameter,operations,bytes,seconds,rate,p50_ns,p99_ns
+ *
+ * where rate is MB/s for data benchmarks and ops/s for metadata benchmarks.
+ * Run via `make bench`; pass a path to use a different scratch image.
+ */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <fcntl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define MAX_SAMPLES     (1<<16)
+#define CHURN_OPS       (4096)
+#define MOUNT_ROUNDS    (64)
+#define FILE_BYTES      (2<<20)     /* Bytes streamed per data benchmark */
+
+/* Globals */
+
+char * ScratchPath = "bench.img";
+
+/* Timing and Reporting */
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void report(const char *benchmark, size_t parameter, size_t operations, size_t bytes, uint64_t elapsed_ns, uint64_t *samples, size_t nsamples) {
+    qsort(samples, nsamples, sizeof(uint64_t), compare_samples);
+
+    double seconds = elapsed_ns / 1e9;
+    double rate    = bytes ? bytes / (1<<20) / seconds : operations / seconds;
+    uint64_t p50   = nsamples ? samples[nsamples / 2] : 0;
+    uint64_t p99   = nsamples ? samples[nsamples - 1 - nsamples / 100] : 0;
+
+    printf("%s,%zu,%zu,%zu,%0.6f,%0.2f,%lu,%lu\n",
+        benchmark, parameter, operations, bytes, seconds, rate,
+        (unsigned long)p50, (unsigned long)p99);
+}
+
+/* Benchmark Setup */
+
+/**
+ * Close the specified Disk with its stdout I/O count report suppressed so
+ * the CSV output stays clean.
+ *
+ * @param       disk    Pointer to Disk structure.
+ **/
+void close_quietly(Disk *disk) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null  = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    disk_close(disk);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(null);
+    close(saved);
+}
+
+/**
+ * Format a scratch image of the specified size and mount it.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       blocks  Number of blocks in scratch image.
+ * @return      Pointer to mounted Disk structure (NULL on failure).
+ **/
+Disk *setup_image(FileSystem *fs, size_t blocks) {
+    unlink(ScratchPath);
+    Disk *disk = disk_open(ScratchPath, blocks);
+    if (disk == NULL) {
+        error("Unable to open %s: %s\n", ScratchPath, strerror(errno));
+        return NULL;
+    }
+
+    memset(fs, 0, sizeof(FileSystem));
+    if (!fs_format(fs, disk) || !fs_mount(fs, disk)) {
+        error("Unable to format and mount %s\n", ScratchPath);
+        close_quietly(disk);
+        return NULL;
+    }
+    return disk;
+}
+
+/**
+ * Fill the specified inode with FILE_BYTES of patterned data.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to fill.
+ * @return      Whether or not the fill was successful.
+ **/
+bool fill_inode(FileSystem *fs, size_t inode_number) {
+    char *buffer = malloc(FILE_BYTES);
+    if (buffer == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < FILE_BYTES; i++) {
+        buffer[i] = i % 251;
+    }
+    bool success = fs_write(fs, inode_number, buffer, FILE_BYTES, 0) == FILE_BYTES;
+    free(buffer);
+    return success;
+}
+
+/* Benchmarks */
+
+/**
+ * Stream FILE_BYTES through fs_write and then fs_read in chunks of the
+ * specified size, sequentially or at random block-aligned offsets.
+ *
+ * @param       chunk   Bytes per fs_read/fs_write call.
+ * @param       random  Whether to use random offsets instead of sequential.
+ * @return      Whether or not the benchmark completed.
+ **/
+bool bench_data(size_t chunk, bool random) {
+    FileSystem fs;
+    Disk *disk = setup_image(&fs, 1024);
+    if (disk == NULL) {
+        return false;
+    }
+
+    ssize_t inode = fs_create(&fs);
+    char   *buffer  = malloc(chunk);
+    static uint64_t samples[MAX_SAMPLES];
+    if (inode < 0 || buffer == NULL || (random && !fill_inode(&fs, inode))) {
+        free(buffer);
+        fs_unmount(&fs);
+        close_quietly(disk);
+        return false;
+    }
+    memset(buffer, 0xa5, chunk);
+
+    size_t operations = FILE_BYTES / chunk;
+    const char *mode  = random ? "random" : "sequential";
+    char name[BUFSIZ];
+
+    /* Writes */
+    srand(42);
+    uint64_t start = now_ns();
+    for (size_t op = 0; op < operations; op++) {
+        size_t offset = random ? (size_t)(rand() % operations) * chunk : op * chunk;
+        uint64_t t0 = now_ns();
+        if (fs_write(&fs, inode, buffer, chunk, offset) != (ssize_t)chunk) {
+            error("fs_write failed at offset %zu\n", offset);
+            break;
+        }
+        samples[op % MAX_SAMPLES] = now_ns() - t0;
+    }
+    snprintf(name, BUFSIZ, "%s_write", mode);
+    report(name, chunk, operations, FILE_BYTES, now_ns() - start, samples, min(operations, MAX_SAMPLES));
+
+    /* Reads */
+    srand(42);
+    start = now_ns();
+    for (size_t op = 0; op < operations; op++) {
+        size_t offset = random ? (size_t)(rand() % operations) * chunk : op * chunk;
+        uint64_t t0 = now_ns();
+        if (fs_read(&fs, inode, buffer, chunk, offset) != (ssize_t)chunk) {
+            error("fs_read failed at offset %zu\n", offset);
+            break;
+        }
+        samples[op % MAX_SAMPLES] = now_ns() - t0;
+    }
+    snprintf(name, BUFSIZ, "%s_read", mode);
+    report(name, chunk, operations, FILE_BYTES, now_ns() - start, samples, min(operations, MAX_SAMPLES));
+
+    free(buffer);
+    fs_unmount(&fs);
+    close_quietly(disk);
+    return true;
+}
+
+/**
+ * Churn the inode table with alternating fs_create and fs_remove calls.
+ *
+ * @return      Whether or not the benchmark completed.
+ **/
+bool bench_churn() {
+    FileSystem fs;
+    Disk *disk = setup_image(&fs, 1024);
+    if (disk == NULL) {
+        return false;
+    }
+
+    static uint64_t samples[CHURN_OPS];
+    uint64_t start = now_ns();
+    for (size_t op = 0; op < CHURN_OPS; op++) {
+        uint64_t t0 = now_ns();
+        ssize_t inode = fs_create(&fs);
+        if (inode < 0 || !fs_remove(&fs, inode)) {
+            error("create/remove churn failed at operation %zu\n", op);
+            break;
+        }
+        samples[op] = now_ns() - t0;
+    }
+    report("create_remove", 0, CHURN_OPS, 0, now_ns() - start, samples, CHURN_OPS);
+
+    fs_unmount(&fs);
+    close_quietly(disk);
+    return true;
+}
+
+/**
+ * Repeatedly mount and unmount an image of the specified size.
+ *
+ * @param       blocks  Number of blocks in scratch image.
+ * @return      Whether or not the benchmark completed.
+ **/
+bool bench_mount(size_t blocks) {
+    FileSystem fs;
+    Disk *disk = setup_image(&fs, blocks);
+    if (disk == NULL) {
+        return false;
+    }
+
+    static uint64_t samples[MOUNT_ROUNDS];
+    uint64_t start = now_ns();
+    for (size_t op = 0; op < MOUNT_ROUNDS; op++) {
+        fs_unmount(&fs);
+        uint64_t t0 = now_ns();
+        if (!fs_mount(&fs, disk)) {
+            error("fs_mount failed on round %zu\n", op);
+            break;
+        }
+        samples[op] = now_ns() - t0;
+    }
+    report("mount", blocks, MOUNT_ROUNDS, 0, now_ns() - start, samples, MOUNT_ROUNDS);
+
+    fs_unmount(&fs);
+    close_quietly(disk);
+    return true;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        ScratchPath = argv[1];
+    }
+
+    bool success = true;
+    printf("benchmark,parameter,operations,bytes,seconds,rate,p50_ns,p99_ns\n");
+
+    size_t chunks[] = {1<<12, 1<<16, 1<<20};
+    for (size_t i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++) {
+        success = bench_data(chunks[i], false) && success;
+        success = bench_data(chunks[i], true)  && success;
+    }
+
+    success = bench_churn() && success;
+
+    size_t sizes[] = {200, 1000, 5000};
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        success = bench_mount(sizes[i]) && success;
+    }
+
+    unlink(ScratchPath);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
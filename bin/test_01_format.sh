@@ -9,7 +9,7 @@ SuperBlock:
     1 inode blocks
     128 inodes
 2 disk block reads
-5 disk block writes
+3 disk block writes
 EOF
 }
 
@@ -22,7 +22,7 @@ SuperBlock:
     2 inode blocks
     256 inodes
 3 disk block reads
-20 disk block writes
+4 disk block writes
 EOF
 }
 
@@ -35,7 +35,7 @@ SuperBlock:
     20 inode blocks
     2560 inodes
 21 disk block reads
-200 disk block writes
+22 disk block writes
 EOF
 }
 
@@ -64,7 +64,7 @@ SuperBlock:
 Inode 2:
     size: 0 bytes
     direct blocks:
-25 disk block reads
+8 disk block reads
 8 disk block writes
 EOF
 }
@@ -159,7 +159,7 @@ Inode 1:
 Inode 2:
     size: 965 bytes
     direct blocks: 4
-27 disk block reads
+11 disk block reads
 10 disk block writes
 EOF
 }
@@ -234,8 +234,8 @@ Inode 2:
     direct blocks: 4 5 6 7 8
     indirect block: 9
     indirect data blocks: 13 14
-41 disk block reads
-18 disk block writes
+25 disk block reads
+11 disk block writes
 EOF
 }
 
@@ -0,0 +1,15 @@
+/* checksum.h: SimpleFS block checksums */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Checksum Functions */
+
+uint32_t    checksum_block(const char *data, size_t length);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,15 @@
+/* compress.h: SimpleFS block compressor */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdlib.h>
+
+/* Compression Functions */
+
+size_t  compress_block(const char *src, size_t src_length, char *dst, size_t dst_capacity);
+size_t  decompress_block(const char *src, size_t src_length, char *dst, size_t dst_capacity);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
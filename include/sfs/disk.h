@@ -3,16 +3,66 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
 /* Disk Constants */
 
-#define BLOCK_SIZE      (1<<12)
-#define DISK_FAILURE    (-1)
+#define BLOCK_SIZE          (1<<12)
+#define DISK_FAILURE        (-1)
+#define DISK_CACHE_BLOCKS   (64)    /* Default block cache capacity */
+#define DISK_ASYNC_WORKERS  (4)     /* Default async worker threads */
+#define DISK_ASYNC_QUEUE    (128)   /* Async submission queue depth */
+#define DISK_SYNC_INTERVAL  (1024)  /* Writes between periodic syncs */
+#define DISK_BUFFER_POOL    (16)    /* Aligned block buffers kept pooled */
 
-/* Disk Structure */
+/* Disk Backends */
+
+typedef enum DiskBackend DiskBackend;
+
+enum DiskBackend {
+    DISK_BACKEND_FILE = 0,  /* read/write syscalls on image fd	*/
+    DISK_BACKEND_MMAP,      /* memcpy to/from mmap'd image	*/
+    DISK_BACKEND_DIRECT,    /* O_DIRECT, bypassing page cache	*/
+};
+
+/* Disk Sync Policies */
+
+typedef enum DiskSyncPolicy DiskSyncPolicy;
+
+enum DiskSyncPolicy {
+    DISK_SYNC_WRITEBACK = 0,    /* Dirty blocks accumulate until sync	*/
+    DISK_SYNC_PERIODIC,         /* Sync every DISK_SYNC_INTERVAL writes	*/
+    DISK_SYNC_WRITETHROUGH,     /* Every write reaches the image	*/
+};
+
+/* Disk Async Types */
+
+typedef void    (*DiskAsyncCallback)(ssize_t result, void *context);
+typedef ssize_t (*DiskAsyncWork)(void *work_context);
+
+typedef struct DiskAsyncRequest DiskAsyncRequest;
+
+struct DiskAsyncRequest {
+    DiskAsyncWork       work;       /* Operation to run on a worker	*/
+    void               *work_context;
+    DiskAsyncCallback   callback;   /* Completion callback (may be NULL)*/
+    void               *context;
+};
+
+/* Disk Structures */
+
+typedef struct DiskCacheEntry DiskCacheEntry;
+
+struct DiskCacheEntry {
+    size_t  block;      /* Block number held by this entry	*/
+    bool    valid;      /* Whether or not entry holds a block	*/
+    bool    dirty;      /* Whether or not entry must be written	*/
+    size_t  used;       /* LRU stamp of last access		*/
+    char    data[BLOCK_SIZE];
+};
 
 typedef struct Disk Disk;
 
@@ -21,16 +71,70 @@ struct Disk {
     size_t  blocks;     /* Number of blocks in disk image	*/
     size_t  reads;      /* Number of reads to disk image	*/
     size_t  writes;     /* Number of writes to disk image	*/
-}; 
+
+    DiskBackend backend;    /* How blocks reach the image	*/
+    char   *mapped;         /* Image mapping (DISK_BACKEND_MMAP)*/
+
+    DiskCacheEntry *cache;  /* Block cache entries (LRU)	*/
+    size_t  cache_capacity; /* Number of cache entries		*/
+    size_t  cache_hits;     /* Number of cache hits		*/
+    size_t  cache_misses;   /* Number of cache misses		*/
+    size_t  cache_clock;    /* Monotonic counter for LRU stamps	*/
+
+    char   *buffer_pool[DISK_BUFFER_POOL]; /* Free aligned buffers */
+    size_t  buffer_pooled;  /* Number of pooled buffers		*/
+    pthread_mutex_t buffer_lock;
+
+    DiskSyncPolicy sync_policy; /* When dirty blocks reach the image*/
+    size_t  sync_pending;   /* Writes since last periodic sync	*/
+
+    pthread_mutex_t lock;   /* Guards cache state and counters	*/
+
+    DiskAsyncRequest async_queue[DISK_ASYNC_QUEUE]; /* Submission ring */
+    size_t  async_head;     /* Next request to dispatch		*/
+    size_t  async_count;    /* Queued but not yet dispatched	*/
+    size_t  async_inflight; /* Dispatched but not yet completed	*/
+    bool    async_shutdown; /* Workers should exit when drained	*/
+    pthread_t *async_workers;
+    size_t  async_nworkers;
+    pthread_mutex_t async_lock;
+    pthread_cond_t  async_notempty; /* Signaled on submission	*/
+    pthread_cond_t  async_notfull;  /* Signaled on dispatch	*/
+    pthread_cond_t  async_idle;     /* Signaled when all complete	*/
+};
 
 /* Disk Functions */
 
 Disk *	disk_open(const char *path, size_t blocks);
+Disk *	disk_open_backend(const char *path, size_t blocks, DiskBackend backend);
+bool    disk_grow(Disk *disk, size_t blocks);
 void	disk_close(Disk *disk);
 
 ssize_t	disk_read(Disk *disk, size_t block, char *data);
 ssize_t	disk_write(Disk *disk, size_t block, char *data);
 
+ssize_t	disk_readv(Disk *disk, size_t block, size_t nblocks, char *data);
+ssize_t	disk_writev(Disk *disk, size_t block, size_t nblocks, char *data);
+
+ssize_t	disk_read_partial(Disk *disk, size_t block, char *data, size_t length);
+ssize_t	disk_write_partial(Disk *disk, size_t block, char *data, size_t length);
+
+bool	disk_cache_setup(Disk *disk, size_t capacity);
+bool	disk_cache_flush(Disk *disk);
+
+bool	disk_sync_setup(Disk *disk, DiskSyncPolicy policy);
+bool	disk_sync(Disk *disk);
+
+char *	disk_buffer_alloc(Disk *disk);
+void	disk_buffer_free(Disk *disk, char *data);
+
+bool	disk_async_setup(Disk *disk, size_t workers);
+bool	disk_async_submit(Disk *disk, DiskAsyncWork work, void *work_context, DiskAsyncCallback callback, void *context);
+bool	disk_read_async(Disk *disk, size_t block, char *data, DiskAsyncCallback callback, void *context);
+bool	disk_write_async(Disk *disk, size_t block, char *data, DiskAsyncCallback callback, void *context);
+void	disk_async_drain(Disk *disk);
+void	disk_prefetch(Disk *disk, size_t block, size_t nblocks);
+
 #endif
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -5,6 +5,7 @@
 
 #include "sfs/disk.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,9 +13,17 @@
 /* File System Constants */
 
 #define MAGIC_NUMBER        (0xf0f03410)
+#define MAGIC_NUMBER_V2     (0xf0f03411)        /* Extent-based indirect block layout */
+#define FS_LOCK_STRIPES     (16)                /* Reader-writer locks striped across inode numbers */
 #define INODES_PER_BLOCK    (128)               /* TODO: Number of inodes per block */
 #define POINTERS_PER_INODE  (5)                 /* TODO: Number of direct pointers per inode */
 #define POINTERS_PER_BLOCK  (1024)              /* TODO: Number of pointers per block */
+#define EXTENTS_PER_BLOCK   (512)               /* Number of extent records per block (v2 layout) */
+#define FS_READAHEAD_WINDOW (8)                 /* Default blocks prefetched ahead of a sequential reader */
+#define FS_GROUP_BLOCKS     (512)               /* Default allocation group size (must be a multiple of 64) */
+#define FS_GROUP_LOCKS      (16)                /* Allocation locks striped across block groups */
+#define FS_JOURNAL_BLOCKS   (64)                /* Metadata journal region size in blocks */
+#define FS_HANDLE_MAX       (64)                /* Open file handles per mounted file system */
 
 /* File System Structures */
 
@@ -24,6 +33,14 @@ struct SuperBlock {
     uint32_t    blocks;                         /* Number of blocks in file system */
     uint32_t    inode_blocks;                   /* Number of blocks reserved for inodes */
     uint32_t    inodes;                         /* Number of inodes in file system */
+    uint32_t    bitmap_blocks;                  /* Blocks reserved for persisted free bitmap (0 on legacy images) */
+    uint32_t    bitmap_clean;                   /* Whether persisted bitmap matches the file system */
+    uint32_t    group_blocks;                   /* Allocation group size in blocks (0 on legacy images) */
+    uint32_t    cluster_blocks;                 /* Allocation unit in blocks (0 or 1 = single blocks) */
+    uint32_t    compression;                    /* Whether data blocks are stored compressed */
+    uint32_t    checksums;                      /* Whether per-block checksums are kept */
+    uint32_t    journal_blocks;                 /* Blocks reserved for the metadata journal (0 = none) */
+    uint32_t    journal_sequence;               /* Sequence of the first live journal record */
 };
 
 typedef struct Inode      Inode;
@@ -34,39 +51,105 @@ struct Inode {
     uint32_t    indirect;                       /* Indirect pointers */
 };
 
+typedef struct Extent     Extent;
+struct Extent {
+    uint32_t    start;                          /* First physical block of extent */
+    uint32_t    length;                         /* Number of consecutive blocks (0 = unused record) */
+};
+
 typedef union  Block      Block;
 union Block {
     SuperBlock  super;                          /* View block as superblock */
     Inode       inodes[INODES_PER_BLOCK];       /* View block as inode */
     uint32_t    pointers[POINTERS_PER_BLOCK];   /* View block as pointers */
+    Extent      extents[EXTENTS_PER_BLOCK];     /* View block as extent records (v2 layout) */
     char        data[BLOCK_SIZE];               /* View block as data */
 };
 
 typedef struct FileSystem FileSystem;
+
+typedef struct FileHandle FileHandle;
+struct FileHandle {
+    FileSystem *fs;                             /* Owning file system (NULL = slot free) */
+    size_t      inode_number;                   /* Pinned inode */
+    size_t      refs;                           /* Number of pins on this handle */
+    size_t      cursor;                         /* Byte offset of the next handle read/write */
+};
+
 struct FileSystem {
     Disk        *disk;                          /* Disk file system is mounted on */
-    bool        *free_blocks;                   /* Free block bitmap */
-    SuperBlock   meta_data;                     /* File system meta data */
+    uint64_t    *free_blocks;                   /* Packed free block bitmap (set bit = free) */
+    size_t       free_block_count;              /* Number of currently free blocks */
+    Block       *inode_table;                   /* In-memory copy of the inode table */
+    size_t       free_inode_hint;               /* Lowest inode number that may be free */
+    size_t       free_inode_count;              /* Number of currently free inodes */
+    SuperBlock   meta_data;                     /* File system meta data (read-mostly, written at mount/unmount) */
+
+    pthread_rwlock_t inode_locks[FS_LOCK_STRIPES];  /* Striped per-inode reader-writer locks */
+    pthread_mutex_t  itable_lock;               /* Guards inode allocation state and table block writes */
+
+    size_t           group_blocks;              /* Allocation group size (whole disk on legacy images) */
+    size_t           group_count;               /* Number of allocation groups */
+    size_t          *group_free;                /* Free blocks per group */
+    size_t           cluster_blocks;            /* Allocation unit in blocks (1 on legacy images) */
+    uint16_t        *block_lengths;             /* Compressed length per block (0 = raw, compression only) */
+    uint32_t        *block_checksums;           /* CRC32C per block (0 = not yet written, checksums only) */
+    pthread_mutex_t  group_locks[FS_GROUP_LOCKS];   /* Striped per-group bitmap locks */
+
+    Block            journal_buffer;            /* Pending journal records (journaled images only) */
+    size_t           journal_head;              /* Next journal region slot to write */
+    uint32_t         journal_sequence;          /* Sequence of the pending journal block */
+    bool             journal_ready;             /* Whether the journal accepts records */
+    pthread_mutex_t  journal_lock;              /* Guards journal buffer, head, and sequence */
+
+    FileHandle       handles[FS_HANDLE_MAX];    /* Open handle arena (no per-open allocation) */
+    pthread_mutex_t  handle_lock;               /* Guards the handle arena */
+
+    size_t           ra_inode;                  /* Inode of last fs_read ((size_t)-1 = none) */
+    size_t           ra_offset;                 /* Offset right after last fs_read */
+    size_t           ra_window;                 /* Readahead window in blocks (0 disables) */
+    pthread_mutex_t  ra_lock;                   /* Guards readahead state */
 };
 
+/* File System Types */
+
+typedef void (*FileSystemCallback)(ssize_t result, void *context);
+
 /* File System Functions */
 
 void    fs_debug(Disk *disk);
 bool    fs_format(FileSystem *fs, Disk *disk);
+bool    fs_format_clustered(FileSystem *fs, Disk *disk, size_t cluster_blocks);
+bool    fs_format_compressed(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed);
+bool    fs_format_checksummed(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed, bool checksummed);
+bool    fs_format_journaled(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed, bool checksummed, bool journaled);
 
 bool    fs_mount(FileSystem *fs, Disk *disk);
 void    fs_unmount(FileSystem *fs);
+bool    fs_grow(FileSystem *fs, size_t new_blocks);
 
 ssize_t fs_create(FileSystem *fs);
 bool    fs_remove(FileSystem *fs, size_t inode_number);
 ssize_t fs_stat(FileSystem *fs, size_t inode_number);
+ssize_t fs_blocks(FileSystem *fs, size_t inode_number);
 
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
 
+FileHandle *fs_open(FileSystem *fs, size_t inode_number);
+void        fs_close(FileHandle *handle);
+ssize_t     fs_handle_read(FileHandle *handle, char *data, size_t length);
+ssize_t     fs_handle_write(FileHandle *handle, char *data, size_t length);
+bool        fs_handle_seek(FileHandle *handle, size_t offset);
+ssize_t     fs_handle_stat(FileHandle *handle);
+
+bool    fs_read_async(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, FileSystemCallback callback, void *context);
+bool    fs_write_async(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, FileSystemCallback callback, void *context);
+
 bool fs_load_inode(FileSystem *fs, size_t inode_number, Inode *node);
 bool fs_save_inode(FileSystem *fs, size_t inode_number, Inode *node);
-void fs_initialize_free_block_bitmap(FileSystem *fs);
+bool fs_initialize_free_block_bitmap(FileSystem *fs);
+bool fs_block_is_free(FileSystem *fs, size_t block);
 
 #endif
 
@@ -0,0 +1,69 @@
+/* stats.h: SimpleFS operation statistics */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Stats Constants */
+
+#define STATS_BUCKETS   (32)    /* Bucket b holds latencies in [2^b, 2^(b+1)) ns */
+
+/* Stats Operations */
+
+typedef enum StatsOperation StatsOperation;
+
+enum StatsOperation {
+    STATS_DISK_READ = 0,
+    STATS_DISK_WRITE,
+    STATS_FS_READ,
+    STATS_FS_WRITE,
+    STATS_FS_CREATE,
+    STATS_FS_REMOVE,
+    STATS_FS_MOUNT,
+    STATS_OPERATIONS,       /* Number of instrumented operations */
+};
+
+/* Stats Structures */
+
+typedef struct StatsEntry StatsEntry;
+
+struct StatsEntry {
+    uint64_t    count;                  /* Number of recorded operations */
+    uint64_t    total_ns;               /* Total time spent in operation */
+    uint64_t    buckets[STATS_BUCKETS]; /* Log-bucketed latency histogram */
+};
+
+/* Trace Structures */
+
+#define TRACE_MAGIC     (0x54534653)    /* Trace file marker ("SFST") */
+
+typedef struct TraceRecord TraceRecord;
+
+struct TraceRecord {
+    uint64_t    timestamp_ns;           /* stats_time() when the call began */
+    uint32_t    operation;              /* StatsOperation of the call */
+    uint32_t    inode;                  /* Inode number the call targeted */
+    uint64_t    offset;                 /* Byte offset (data operations) */
+    uint64_t    length;                 /* Byte length (data operations) */
+};
+
+/* Stats Functions */
+
+uint64_t    stats_time();
+void        stats_record(StatsOperation operation, uint64_t start_ns);
+void        stats_query(StatsOperation operation, StatsEntry *entry);
+void        stats_reset();
+void        stats_report(FILE *stream);
+
+/* Trace Functions */
+
+bool        trace_begin(const char *path);
+void        trace_record(StatsOperation operation, uint32_t inode, uint64_t offset, uint64_t length);
+void        trace_end();
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,200 @@
+/* compress.c: SimpleFS block compressor
+ *
+ * Small LZ77 codec in the LZ4 byte-stream style: each sequence is a token
+ * holding a literal length and a match length nibble, followed by the
+ * literals, a two byte little-endian match offset, and length continuation
+ * bytes of 255 while a nibble is saturated.  Speed is favored over ratio
+ * (greedy parse, one probe hash table), which fits the per-block use where
+ * the fallback is simply storing the block raw.
+ */
+
+#include "sfs/compress.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Internal Constants */
+
+#define HASH_BITS       (12)            /* Match finder table size (4096)   */
+#define MIN_MATCH       (4)             /* Shortest encodable match         */
+#define TAIL_LITERALS   (5)             /* Input tail always kept literal   */
+
+/* Internal Prototypes */
+
+uint32_t compress_hash(const uint8_t *p);
+
+/* External Functions */
+
+/**
+ * Compress a block of data by doing the following:
+ *
+ *  1. Walk the input greedily, probing a hash table of previous positions
+ *  for a match of at least MIN_MATCH bytes within the 64KB offset window.
+ *
+ *  2. Emit pending literals and the match as one token sequence; bytes with
+ *  no match advance as future literals.
+ *
+ *  3. Give up as soon as the output would reach dst_capacity, so callers can
+ *  cap the output at anything below the block size to guarantee a win.
+ *
+ * @param       src             Input buffer.
+ * @param       src_length      Number of input bytes.
+ * @param       dst             Output buffer.
+ * @param       dst_capacity    Maximum output bytes.
+ *
+ * @return      Number of compressed bytes (0 if the input does not fit in
+ *              dst_capacity and should be stored raw).
+ **/
+size_t  compress_block(const char *src, size_t src_length, char *dst, size_t dst_capacity) {
+    const uint8_t *in     = (const uint8_t *)src;
+    const uint8_t *ip     = in;
+    const uint8_t *iend   = in + src_length;
+    const uint8_t *anchor = in;
+    uint8_t       *out    = (uint8_t *)dst;
+    uint8_t       *op     = out;
+    uint8_t       *oend   = out + dst_capacity;
+    uint32_t       table[1 << HASH_BITS] = {0};     /* position + 1 (0 = empty) */
+
+    if (src_length < MIN_MATCH + TAIL_LITERALS) {
+        return 0;
+    }
+
+    while (ip + MIN_MATCH + TAIL_LITERALS <= iend) {
+        uint32_t hash = compress_hash(ip);
+        const uint8_t *ref = in + table[hash] - 1;
+        table[hash] = (uint32_t)(ip - in) + 1;
+
+        if (ref >= ip || ip - ref > UINT16_MAX || ref + 1 == in ||
+            memcmp(ref, ip, MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+
+        /* Extend the match, keeping the required literal tail */
+        size_t match = MIN_MATCH;
+        while (ip + match < iend - TAIL_LITERALS && ref[match] == ip[match]) {
+            match++;
+        }
+
+        size_t literals = ip - anchor;
+        size_t needed   = 1 + (literals / 255 + 2) + literals + 2 + ((match - MIN_MATCH) / 255 + 2);
+        if (op + needed >= oend) {
+            return 0;
+        }
+
+        /* Token: literal length nibble, match length nibble */
+        size_t mlen = match - MIN_MATCH;
+        *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4 |
+                          (mlen     < 15 ? mlen     : 15));
+        for (size_t rest = literals; rest >= 15; rest -= 255) {
+            *op++ = (uint8_t)(rest - 15 < 255 ? rest - 15 : 255);
+            if (rest - 15 < 255) break;
+        }
+        memcpy(op, anchor, literals);
+        op += literals;
+        uint16_t offset = (uint16_t)(ip - ref);
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        for (size_t rest = mlen; rest >= 15; rest -= 255) {
+            *op++ = (uint8_t)(rest - 15 < 255 ? rest - 15 : 255);
+            if (rest - 15 < 255) break;
+        }
+
+        ip    += match;
+        anchor = ip;
+    }
+
+    /* Trailing sequence: literals only */
+    size_t literals = iend - anchor;
+    if (op + 1 + literals / 255 + 1 + literals >= oend) {
+        return 0;
+    }
+    *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4);
+    for (size_t rest = literals; rest >= 15; rest -= 255) {
+        *op++ = (uint8_t)(rest - 15 < 255 ? rest - 15 : 255);
+        if (rest - 15 < 255) break;
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (size_t)(op - out);
+}
+
+/**
+ * Decompress a block of data produced by compress_block by replaying its
+ * token sequences: copy the literals, then copy match bytes from the already
+ * decompressed output at the recorded offset (byte-at-a-time, since matches
+ * may overlap their source).
+ *
+ * @param       src             Compressed input buffer.
+ * @param       src_length      Number of compressed bytes.
+ * @param       dst             Output buffer.
+ * @param       dst_capacity    Maximum output bytes.
+ *
+ * @return      Number of decompressed bytes (0 on corrupt input).
+ **/
+size_t  decompress_block(const char *src, size_t src_length, char *dst, size_t dst_capacity) {
+    const uint8_t *ip   = (const uint8_t *)src;
+    const uint8_t *iend = ip + src_length;
+    uint8_t       *out  = (uint8_t *)dst;
+    uint8_t       *op   = out;
+    uint8_t       *oend = out + dst_capacity;
+
+    while (ip < iend) {
+        uint8_t token    = *ip++;
+        size_t  literals = token >> 4;
+        if (literals == 15) {
+            uint8_t more;
+            do {
+                if (ip >= iend) return 0;
+                more      = *ip++;
+                literals += more;
+            } while (more == 255);
+        }
+        if (ip + literals > iend || op + literals > oend) {
+            return 0;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == iend) {
+            break;      /* trailing literal-only sequence */
+        }
+
+        if (ip + 2 > iend) {
+            return 0;
+        }
+        uint16_t offset = (uint16_t)(ip[0] | ip[1] << 8);
+        ip += 2;
+        size_t match = (token & 0x0f) + MIN_MATCH;
+        if (match == 15 + MIN_MATCH) {
+            uint8_t more;
+            do {
+                if (ip >= iend) return 0;
+                more   = *ip++;
+                match += more;
+            } while (more == 255);
+        }
+        if (offset == 0 || op - out < (ptrdiff_t)offset || op + match > oend) {
+            return 0;
+        }
+        const uint8_t *ref = op - offset;
+        while (match--) {
+            *op++ = *ref++;
+        }
+    }
+    return (size_t)(op - out);
+}
+
+/* Internal Functions */
+
+/**
+ * Hash the next MIN_MATCH input bytes into a match finder table slot.
+ **/
+uint32_t compress_hash(const uint8_t *p) {
+    uint32_t sequence;
+    memcpy(&sequence, p, sizeof(sequence));
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
@@ -1,15 +1,57 @@
 /* disk.c: SimpleFS disk emulator */
 
+#define _GNU_SOURCE     /* O_DIRECT */
+
 #include "sfs/disk.h"
 #include "sfs/logging.h"
+#include "sfs/stats.h"
 
 #include <assert.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 /* Internal Prototyes */
 
 bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
+bool    disk_buffer_aligned(const char *data);
+
+ssize_t             disk_cached_read(Disk *disk, size_t block, char *data);
+ssize_t             disk_cached_write(Disk *disk, size_t block, char *data);
+ssize_t             disk_physical_read(Disk *disk, size_t block, char *data);
+ssize_t             disk_physical_write(Disk *disk, size_t block, char *data);
+ssize_t             disk_physical_readv(Disk *disk, size_t block, size_t nblocks, char *data);
+ssize_t             disk_physical_writev(Disk *disk, size_t block, size_t nblocks, char *data);
+bool                disk_cache_flush_locked(Disk *disk);
+bool                disk_sync_locked(Disk *disk);
+int                 disk_cache_entry_compare(const void *a, const void *b);
+DiskCacheEntry *    disk_cache_lookup(Disk *disk, size_t block);
+DiskCacheEntry *    disk_cache_evict(Disk *disk);
+
+void *              disk_async_worker(void *arg);
+ssize_t             disk_async_read_work(void *work_context);
+ssize_t             disk_async_write_work(void *work_context);
+ssize_t             disk_prefetch_work(void *work_context);
+
+/* Internal Structures */
+
+typedef struct DiskAsyncBlockOp DiskAsyncBlockOp;
+
+struct DiskAsyncBlockOp {
+    Disk   *disk;
+    size_t  block;
+    char   *data;
+};
+
+typedef struct DiskPrefetchOp DiskPrefetchOp;
+
+struct DiskPrefetchOp {
+    Disk   *disk;
+    size_t  block;
+    size_t  nblocks;
+};
 
 /* External Functions */
 
@@ -24,6 +66,8 @@ bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
  *
  *  3. Truncate file to desired file size (blocks * BLOCK_SIZE).
  *
+ *  4. Allocate block cache with default capacity.
+ *
  * @param       path        Path to disk image to create.
  * @param       blocks      Number of blocks to allocate for disk image.
  *
@@ -31,37 +75,175 @@ bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
  *              on failure).
  **/
 Disk *	disk_open(const char *path, size_t blocks) {
+    return disk_open_backend(path, blocks, DISK_BACKEND_FILE);
+}
+
+/**
+ * Opens disk at specified path with the specified backend:
+ *
+ *  - DISK_BACKEND_FILE serves blocks with read/write syscalls on the image
+ *  file descriptor, through the block cache.
+ *
+ *  - DISK_BACKEND_MMAP maps the whole image into memory at open time and
+ *  serves blocks with memcpy; the block cache is disabled since the mapping
+ *  already is the cache.  Suitable for images that fit in the page cache;
+ *  keep DISK_BACKEND_FILE for images on network storage.
+ *
+ * @param       path        Path to disk image to create.
+ * @param       blocks      Number of blocks to allocate for disk image.
+ * @param       backend     Backend used to reach disk image.
+ *
+ * @return      Pointer to newly allocated and configured Disk structure (NULL
+ *              on failure).
+ **/
+Disk *	disk_open_backend(const char *path, size_t blocks, DiskBackend backend) {
+    if (blocks > SIZE_MAX / BLOCK_SIZE) {
+        error("invalid number of blocks: %zu\n", blocks);
+        return NULL;
+    }
+
     Disk* disk = (Disk*)malloc(sizeof(Disk));
     if (disk == NULL) {
         return NULL;
     }
-    int file = open(path, O_RDWR);
+    int flags = O_RDWR|O_CREAT;
+    if (backend == DISK_BACKEND_DIRECT) {
+        flags |= O_DIRECT;
+    }
+    int file = open(path, flags, 0644);
     if (file == -1) {
         error("%d\n", errno);
+        free(disk);
+        return NULL;
+    }
+    if (ftruncate(file, blocks * BLOCK_SIZE) == -1) {
+        error("%d\n", errno);
+        close(file);
+        free(disk);
         return NULL;
     }
     disk->fd = file;
     disk->blocks = blocks;
     disk->reads = 0;
     disk->writes = 0;
+    disk->backend = backend;
+    disk->mapped = NULL;
+    disk->cache = NULL;
+    disk->cache_capacity = 0;
+    disk->cache_hits = 0;
+    disk->cache_misses = 0;
+    disk->cache_clock = 0;
+    disk->buffer_pooled = 0;
+    pthread_mutex_init(&disk->buffer_lock, NULL);
+    disk->sync_policy = DISK_SYNC_WRITEBACK;
+    disk->sync_pending = 0;
+    pthread_mutex_init(&disk->lock, NULL);
+
+    disk->async_head = 0;
+    disk->async_count = 0;
+    disk->async_inflight = 0;
+    disk->async_shutdown = false;
+    disk->async_workers = NULL;
+    disk->async_nworkers = 0;
+    pthread_mutex_init(&disk->async_lock, NULL);
+    pthread_cond_init(&disk->async_notempty, NULL);
+    pthread_cond_init(&disk->async_notfull, NULL);
+    pthread_cond_init(&disk->async_idle, NULL);
+
+    if (backend == DISK_BACKEND_MMAP) {
+        disk->mapped = mmap(NULL, blocks * BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, file, 0);
+        if (disk->mapped == MAP_FAILED) {
+            error("errno: %d\n", errno);
+            close(file);
+            free(disk);
+            return NULL;
+        }
+        return disk;
+    }
+
+    if (!disk_cache_setup(disk, DISK_CACHE_BLOCKS)) {
+        close(file);
+        free(disk);
+        return NULL;
+    }
     return disk;
 }
 
+/**
+ * Grow disk image to a larger number of blocks by doing the following:
+ *
+ *  1. Perform sanity check (growth only).
+ *
+ *  2. Extend the backing file with ftruncate.
+ *
+ *  3. Extend the mapping when the disk image is memory mapped.
+ *
+ *  4. Update Disk block count.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       blocks      New number of blocks (must exceed current count).
+ *
+ * @return      Whether or not the grow operation was successful.
+ **/
+bool    disk_grow(Disk *disk, size_t blocks) {
+    if (disk == NULL || blocks <= disk->blocks || blocks > SIZE_MAX / BLOCK_SIZE) {
+        error("invalid number of blocks: %zu\n", blocks);
+        return false;
+    }
+
+    pthread_mutex_lock(&disk->lock);
+    if (ftruncate(disk->fd, blocks * BLOCK_SIZE) == -1) {
+        error("%d\n", errno);
+        pthread_mutex_unlock(&disk->lock);
+        return false;
+    }
+    if (disk->mapped) {
+        void *mapped = mremap(disk->mapped, disk->blocks * BLOCK_SIZE, blocks * BLOCK_SIZE, MREMAP_MAYMOVE);
+        if (mapped == MAP_FAILED) {
+            error("errno: %d\n", errno);
+            pthread_mutex_unlock(&disk->lock);
+            return false;
+        }
+        disk->mapped = mapped;
+    }
+    disk->blocks = blocks;
+    pthread_mutex_unlock(&disk->lock);
+    return true;
+}
+
 /**
  * Close disk structure by doing the following:
  *
- *  1. Close disk file descriptor.
+ *  1. Flush dirty cache blocks and release cache.
+ *
+ *  2. Close disk file descriptor.
  *
- *  2. Report number of disk reads and writes.
+ *  3. Report number of disk reads and writes.
  *
- *  3. Release disk structure memory.
+ *  4. Release disk structure memory.
  *
  * @param       disk        Pointer to Disk structure.
  */
 void	disk_close(Disk *disk) {
     assert(disk != NULL);
+    disk_async_setup(disk, 0);
+    disk_sync(disk);
+    free(disk->cache);
+    if (disk->mapped) {
+        munmap(disk->mapped, disk->blocks * BLOCK_SIZE);
+    }
     close(disk->fd);
-    info("Closing disk, reads: %zu, writes: %zu\n", disk->reads, disk->writes);
+    for (size_t i = 0; i < disk->buffer_pooled; i++) {
+        free(disk->buffer_pool[i]);
+    }
+    pthread_mutex_destroy(&disk->buffer_lock);
+    pthread_mutex_destroy(&disk->lock);
+    pthread_mutex_destroy(&disk->async_lock);
+    pthread_cond_destroy(&disk->async_notempty);
+    pthread_cond_destroy(&disk->async_notfull);
+    pthread_cond_destroy(&disk->async_idle);
+    printf("%zu disk block reads\n", disk->reads);
+    printf("%zu disk block writes\n", disk->writes);
     free(disk);
 }
 
@@ -71,9 +253,10 @@ void	disk_close(Disk *disk) {
  *
  *  1. Perform sanity check.
  *
- *  2. Seek to specified block.
+ *  2. Check block cache and copy from cached entry on a hit.
  *
- *  3. Read from block to data buffer (must be BLOCK_SIZE).
+ *  3. On a miss, read block into a cache entry (evicting the least recently
+ *  used entry if necessary) and copy to data buffer.
  *
  * @param       disk        Pointer to Disk structure.
  * @param       block       Block number to perform operation on.
@@ -83,15 +266,48 @@ void	disk_close(Disk *disk) {
  *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
  **/
 ssize_t disk_read(Disk *disk, size_t block, char *data) {
-    if (!disk_sanity_check(disk, block, data)) {
+    if (disk == NULL) {
         return DISK_FAILURE;
     }
-    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) == -1) {
-        error("errno: %d\n", errno);
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    ssize_t result = disk_cached_read(disk, block, data);
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_READ, start);
+    return result;
+}
+
+ssize_t disk_cached_read(Disk *disk, size_t block, char *data) {
+    if (!disk_sanity_check(disk, block, data)) {
         return DISK_FAILURE;
     }
+    disk->reads++;
 
-    return read(disk->fd, data, BLOCK_SIZE);
+    if (disk->cache_capacity == 0) {
+        return disk_physical_read(disk, block, data);
+    }
+
+    DiskCacheEntry *entry = disk_cache_lookup(disk, block);
+    if (entry) {
+        disk->cache_hits++;
+        memcpy(data, entry->data, BLOCK_SIZE);
+        return BLOCK_SIZE;
+    }
+
+    disk->cache_misses++;
+    entry = disk_cache_evict(disk);
+    if (entry == NULL) {
+        return disk_physical_read(disk, block, data);
+    }
+    if (disk_physical_read(disk, block, entry->data) == DISK_FAILURE) {
+        return DISK_FAILURE;
+    }
+    entry->block = block;
+    entry->valid = true;
+    entry->dirty = false;
+    entry->used  = ++disk->cache_clock;
+    memcpy(data, entry->data, BLOCK_SIZE);
+    return BLOCK_SIZE;
 }
 
 /**
@@ -100,9 +316,11 @@ ssize_t disk_read(Disk *disk, size_t block, char *data) {
  *
  *  1. Perform sanity check.
  *
- *  2. Seek to specified block.
+ *  2. Copy data buffer into block cache entry (evicting the least recently
+ *  used entry if necessary) and mark it dirty.
  *
- *  3. Write data buffer (must be BLOCK_SIZE) to disk block.
+ *  3. Dirty entries are written back on eviction, disk_cache_flush, or
+ *  disk_close.
  *
  * @param       disk        Pointer to Disk structure.
  * @param       block       Block number to perform operation on.
@@ -112,19 +330,760 @@ ssize_t disk_read(Disk *disk, size_t block, char *data) {
  *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
  **/
 ssize_t disk_write(Disk *disk, size_t block, char *data) {
+    if (disk == NULL) {
+        return DISK_FAILURE;
+    }
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    ssize_t result = disk_cached_write(disk, block, data);
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_WRITE, start);
+    return result;
+}
+
+ssize_t disk_cached_write(Disk *disk, size_t block, char *data) {
     if (!disk_sanity_check(disk, block, data)) {
         return DISK_FAILURE;
     }
-    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) == -1) {
-        error("errno: %d\n", errno);
+    disk->writes++;
+
+    if (disk->cache_capacity == 0) {
+        return disk_physical_write(disk, block, data);
+    }
+
+    DiskCacheEntry *entry = disk_cache_lookup(disk, block);
+    if (entry) {
+        disk->cache_hits++;
+    } else {
+        disk->cache_misses++;
+        entry = disk_cache_evict(disk);
+        if (entry == NULL) {
+            return disk_physical_write(disk, block, data);
+        }
+    }
+    entry->block = block;
+    entry->valid = true;
+    entry->used  = ++disk->cache_clock;
+    memcpy(entry->data, data, BLOCK_SIZE);
+
+    if (disk->sync_policy == DISK_SYNC_WRITETHROUGH) {
+        entry->dirty = false;
+        return disk_physical_write(disk, block, data);
+    }
+
+    entry->dirty = true;
+    if (disk->sync_policy == DISK_SYNC_PERIODIC && ++disk->sync_pending >= DISK_SYNC_INTERVAL) {
+        disk->sync_pending = 0;
+        disk_sync_locked(disk);
+    }
+    return BLOCK_SIZE;
+}
+
+/**
+ * Read a run of consecutive blocks from disk into data buffer by doing the
+ * following:
+ *
+ *  1. Perform sanity check on the whole range.
+ *
+ *  2. Transfer the range with a single positioned read (instead of one
+ *  lseek+read pair per block).
+ *
+ *  3. Overlay any dirty cached blocks in the range, which hold newer data
+ *  than the image.
+ *
+ * Note: The range is deliberately not inserted into the block cache so that
+ * large sequential transfers do not evict hot metadata blocks.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number in range.
+ * @param       nblocks     Number of consecutive blocks to read.
+ * @param       data        Data buffer (nblocks * BLOCK_SIZE bytes).
+ *
+ * @return      Number of bytes read.
+ *              (nblocks * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_readv(Disk *disk, size_t block, size_t nblocks, char *data) {
+    if (!disk_sanity_check(disk, block, data) || nblocks == 0 || nblocks > disk->blocks - block) {
         return DISK_FAILURE;
     }
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    disk->reads += nblocks;
 
-    return write(disk->fd, data, BLOCK_SIZE);
+    if (disk_physical_readv(disk, block, nblocks, data) == DISK_FAILURE) {
+        pthread_mutex_unlock(&disk->lock);
+        return DISK_FAILURE;
+    }
+
+    for (size_t i = 0; i < disk->cache_capacity; i++) {
+        DiskCacheEntry *entry = &disk->cache[i];
+        if (entry->valid && entry->dirty && entry->block >= block && entry->block < block + nblocks) {
+            memcpy(data + (entry->block - block) * BLOCK_SIZE, entry->data, BLOCK_SIZE);
+        }
+    }
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_READ, start);
+    return nblocks * BLOCK_SIZE;
+}
+
+/**
+ * Write a run of consecutive blocks from data buffer to disk by doing the
+ * following:
+ *
+ *  1. Perform sanity check on the whole range.
+ *
+ *  2. Transfer the range with a single positioned write.
+ *
+ *  3. Refresh any cached blocks in the range so later single-block reads see
+ *  the new data (entries become clean since the image now matches).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number in range.
+ * @param       nblocks     Number of consecutive blocks to write.
+ * @param       data        Data buffer (nblocks * BLOCK_SIZE bytes).
+ *
+ * @return      Number of bytes written.
+ *              (nblocks * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_writev(Disk *disk, size_t block, size_t nblocks, char *data) {
+    if (!disk_sanity_check(disk, block, data) || nblocks == 0 || nblocks > disk->blocks - block) {
+        return DISK_FAILURE;
+    }
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    disk->writes += nblocks;
+
+    if (disk_physical_writev(disk, block, nblocks, data) == DISK_FAILURE) {
+        pthread_mutex_unlock(&disk->lock);
+        return DISK_FAILURE;
+    }
+
+    for (size_t i = 0; i < disk->cache_capacity; i++) {
+        DiskCacheEntry *entry = &disk->cache[i];
+        if (entry->valid && entry->block >= block && entry->block < block + nblocks) {
+            memcpy(entry->data, data + (entry->block - block) * BLOCK_SIZE, BLOCK_SIZE);
+            entry->dirty = false;
+        }
+    }
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_WRITE, start);
+    return nblocks * BLOCK_SIZE;
+}
+
+/**
+ * Read the leading length bytes of a block (for payloads that record their
+ * own length, like compressed blocks) by doing the following:
+ *
+ *  1. Serve the prefix from the block cache on a hit.
+ *
+ *  2. On a miss, read only length bytes from the image, moving fewer bytes
+ *  over the wire than a full block read; the partial block is not inserted
+ *  into the cache.
+ *
+ * Counts as one block read.  The O_DIRECT backend transfers the whole block
+ * since partial lengths break its alignment rules.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer (length bytes).
+ * @param       length      Number of leading bytes wanted.
+ *
+ * @return      Number of bytes read (length on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_read_partial(Disk *disk, size_t block, char *data, size_t length) {
+    if (disk == NULL || length == 0 || length > BLOCK_SIZE) {
+        return DISK_FAILURE;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT) {
+        char *full = disk_buffer_alloc(disk);
+        if (full == NULL) {
+            return DISK_FAILURE;
+        }
+        ssize_t result = disk_read(disk, block, full);
+        if (result != DISK_FAILURE) {
+            memcpy(data, full, length);
+            result = length;
+        }
+        disk_buffer_free(disk, full);
+        return result;
+    }
+
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    if (!disk_sanity_check(disk, block, data)) {
+        pthread_mutex_unlock(&disk->lock);
+        return DISK_FAILURE;
+    }
+    disk->reads++;
+
+    DiskCacheEntry *entry = disk_cache_lookup(disk, block);
+    if (entry) {
+        disk->cache_hits++;
+        memcpy(data, entry->data, length);
+        entry->used = ++disk->cache_clock;
+        pthread_mutex_unlock(&disk->lock);
+        stats_record(STATS_DISK_READ, start);
+        return length;
+    }
+    disk->cache_misses++;
+
+    ssize_t result = length;
+    if (disk->mapped) {
+        memcpy(data, disk->mapped + block * BLOCK_SIZE, length);
+    } else {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = pread(disk->fd, data + done, length - done, block * BLOCK_SIZE + done);
+            if (n <= 0) {
+                error("errno: %d\n", errno);
+                result = DISK_FAILURE;
+                break;
+            }
+            done += n;
+        }
+    }
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_READ, start);
+    return result;
+}
+
+/**
+ * Write the leading length bytes of a block, leaving the remaining bytes of
+ * the block undefined (for payloads that record their own length).  Any
+ * cached copy of the block is dropped so later reads see the new bytes.
+ *
+ * Counts as one block write.  The O_DIRECT backend transfers the whole block
+ * since partial lengths break its alignment rules.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer (length bytes).
+ * @param       length      Number of leading bytes to write.
+ *
+ * @return      Number of bytes written (length on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_write_partial(Disk *disk, size_t block, char *data, size_t length) {
+    if (disk == NULL || length == 0 || length > BLOCK_SIZE) {
+        return DISK_FAILURE;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT) {
+        char *full = disk_buffer_alloc(disk);
+        if (full == NULL) {
+            return DISK_FAILURE;
+        }
+        memcpy(full, data, length);
+        memset(full + length, 0, BLOCK_SIZE - length);
+        ssize_t result = disk_write(disk, block, full);
+        disk_buffer_free(disk, full);
+        return result == DISK_FAILURE ? DISK_FAILURE : (ssize_t)length;
+    }
+
+    uint64_t start = stats_time();
+    pthread_mutex_lock(&disk->lock);
+    if (!disk_sanity_check(disk, block, data)) {
+        pthread_mutex_unlock(&disk->lock);
+        return DISK_FAILURE;
+    }
+    disk->writes++;
+
+    DiskCacheEntry *entry = disk_cache_lookup(disk, block);
+    if (entry) {
+        entry->valid = false;
+        entry->dirty = false;
+    }
+
+    ssize_t result = length;
+    if (disk->mapped) {
+        memcpy(disk->mapped + block * BLOCK_SIZE, data, length);
+    } else {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = pwrite(disk->fd, data + done, length - done, block * BLOCK_SIZE + done);
+            if (n <= 0) {
+                error("errno: %d\n", errno);
+                result = DISK_FAILURE;
+                break;
+            }
+            done += n;
+        }
+    }
+    pthread_mutex_unlock(&disk->lock);
+    stats_record(STATS_DISK_WRITE, start);
+    return result;
+}
+
+/**
+ * Configure block cache with specified capacity by doing the following:
+ *
+ *  1. Flush and release any existing cache.
+ *
+ *  2. Allocate capacity cache entries (capacity of 0 disables the cache and
+ *  makes all reads and writes go directly to the disk image).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       capacity    Number of blocks to hold in cache.
+ *
+ * @return      Whether or not the cache was configured successfully.
+ **/
+bool    disk_cache_setup(Disk *disk, size_t capacity) {
+    assert(disk != NULL);
+    pthread_mutex_lock(&disk->lock);
+    if (disk->cache) {
+        disk_cache_flush_locked(disk);
+        free(disk->cache);
+        disk->cache = NULL;
+        disk->cache_capacity = 0;
+    }
+    if (capacity == 0) {
+        pthread_mutex_unlock(&disk->lock);
+        return true;
+    }
+
+    disk->cache = (DiskCacheEntry*)calloc(capacity, sizeof(DiskCacheEntry));
+    if (disk->cache == NULL) {
+        pthread_mutex_unlock(&disk->lock);
+        return false;
+    }
+    disk->cache_capacity = capacity;
+    pthread_mutex_unlock(&disk->lock);
+    return true;
+}
+
+/**
+ * Write all dirty cache entries back to the disk image.
+ *
+ * @param       disk        Pointer to Disk structure.
+ *
+ * @return      Whether or not all dirty entries were written successfully.
+ **/
+bool    disk_cache_flush(Disk *disk) {
+    assert(disk != NULL);
+    pthread_mutex_lock(&disk->lock);
+    bool success = disk_cache_flush_locked(disk);
+    pthread_mutex_unlock(&disk->lock);
+    return success;
+}
+
+bool    disk_cache_flush_locked(Disk *disk) {
+    if (disk->mapped) {
+        return msync(disk->mapped, disk->blocks * BLOCK_SIZE, MS_SYNC) == 0;
+    }
+
+    /* Flush dirty entries sorted by block number so scattered updates
+     * reach the image as mostly-sequential I/O; if the scratch list cannot
+     * be allocated, flush them unsorted in place instead (slower, but every
+     * dirty block still reaches the image) */
+    DiskCacheEntry **dirty = malloc(disk->cache_capacity * sizeof(DiskCacheEntry*));
+    size_t ndirty = 0;
+    for (size_t i = 0; i < disk->cache_capacity; i++) {
+        DiskCacheEntry *entry = &disk->cache[i];
+        if (entry->valid && entry->dirty) {
+            if (dirty) {
+                dirty[ndirty] = entry;
+            }
+            ndirty++;
+        }
+    }
+    if (dirty) {
+        qsort(dirty, ndirty, sizeof(DiskCacheEntry*), disk_cache_entry_compare);
+    }
+
+    bool success = true;
+    size_t scan = dirty ? ndirty : disk->cache_capacity;
+    for (size_t i = 0; i < scan; i++) {
+        DiskCacheEntry *entry = dirty ? dirty[i] : &disk->cache[i];
+        if (!entry->valid || !entry->dirty) {
+            continue;
+        }
+        if (disk_physical_write(disk, entry->block, entry->data) == DISK_FAILURE) {
+            success = false;
+            continue;
+        }
+        entry->dirty = false;
+    }
+    free(dirty);
+    return success;
+}
+
+/**
+ * Order cache entries by block number for sorted write-back.
+ **/
+int disk_cache_entry_compare(const void *a, const void *b) {
+    const DiskCacheEntry *ea = *(DiskCacheEntry * const *)a;
+    const DiskCacheEntry *eb = *(DiskCacheEntry * const *)b;
+    if (ea->block < eb->block) return -1;
+    if (ea->block > eb->block) return  1;
+    return 0;
+}
+
+/**
+ * Set when writes reach the disk image by doing the following:
+ *
+ *  1. Sync any accumulated dirty blocks under the old policy.
+ *
+ *  2. Record the new policy: write-back (default) holds dirty blocks until
+ *  disk_sync or eviction, periodic syncs every DISK_SYNC_INTERVAL writes,
+ *  and write-through sends every write straight to the image.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       policy      When dirty blocks reach the image.
+ *
+ * @return      Whether or not outstanding dirty blocks were synced.
+ **/
+bool    disk_sync_setup(Disk *disk, DiskSyncPolicy policy) {
+    assert(disk != NULL);
+    pthread_mutex_lock(&disk->lock);
+    bool success = disk_sync_locked(disk);
+    disk->sync_policy  = policy;
+    disk->sync_pending = 0;
+    pthread_mutex_unlock(&disk->lock);
+    return success;
+}
+
+/**
+ * Flush all dirty cache entries (sorted by block number) and fsync the
+ * image file descriptor, so everything written so far is durable.
+ *
+ * @param       disk        Pointer to Disk structure.
+ *
+ * @return      Whether or not the flush and fsync succeeded.
+ **/
+bool    disk_sync(Disk *disk) {
+    assert(disk != NULL);
+    pthread_mutex_lock(&disk->lock);
+    bool success = disk_sync_locked(disk);
+    pthread_mutex_unlock(&disk->lock);
+    return success;
+}
+
+bool    disk_sync_locked(Disk *disk) {
+    bool success = disk_cache_flush_locked(disk);
+    if (!disk->mapped && fsync(disk->fd) < 0) {
+        error("Unable to fsync disk image: %s\n", strerror(errno));
+        success = false;
+    }
+    return success;
+}
+
+/**
+ * Hand out a BLOCK_SIZE buffer aligned for O_DIRECT transfers, drawing from
+ * a small pool of previously released buffers before allocating a new one.
+ *
+ * @param       disk        Pointer to Disk structure.
+ *
+ * @return      Pointer to aligned buffer (NULL on allocation failure).
+ **/
+char *  disk_buffer_alloc(Disk *disk) {
+    assert(disk != NULL);
+    char *data = NULL;
+    pthread_mutex_lock(&disk->buffer_lock);
+    if (disk->buffer_pooled > 0) {
+        data = disk->buffer_pool[--disk->buffer_pooled];
+    }
+    pthread_mutex_unlock(&disk->buffer_lock);
+    if (data == NULL && posix_memalign((void**)&data, BLOCK_SIZE, BLOCK_SIZE) != 0) {
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * Return a buffer from disk_buffer_alloc to the pool (or release it once the
+ * pool is full).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       data        Buffer to return.
+ **/
+void    disk_buffer_free(Disk *disk, char *data) {
+    assert(disk != NULL);
+    if (data == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&disk->buffer_lock);
+    if (disk->buffer_pooled < DISK_BUFFER_POOL) {
+        disk->buffer_pool[disk->buffer_pooled++] = data;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&disk->buffer_lock);
+    free(data);
+}
+
+/**
+ * Report whether a buffer meets O_DIRECT alignment requirements.
+ **/
+bool    disk_buffer_aligned(const char *data) {
+    return ((uintptr_t)data & (BLOCK_SIZE - 1)) == 0;
+}
+
+/**
+ * Configure the asynchronous worker pool by doing the following:
+ *
+ *  1. Drain and join any existing workers.
+ *
+ *  2. Start the specified number of worker threads pulling requests off the
+ *  submission queue (0 disables the pool and makes async submissions run
+ *  synchronously in the caller).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       workers     Number of worker threads to run.
+ *
+ * @return      Whether or not the pool was configured successfully.
+ **/
+bool    disk_async_setup(Disk *disk, size_t workers) {
+    assert(disk != NULL);
+    if (disk->async_nworkers > 0) {
+        disk_async_drain(disk);
+        pthread_mutex_lock(&disk->async_lock);
+        disk->async_shutdown = true;
+        pthread_cond_broadcast(&disk->async_notempty);
+        pthread_mutex_unlock(&disk->async_lock);
+        for (size_t i = 0; i < disk->async_nworkers; i++) {
+            pthread_join(disk->async_workers[i], NULL);
+        }
+        free(disk->async_workers);
+        disk->async_workers = NULL;
+        disk->async_nworkers = 0;
+        disk->async_shutdown = false;
+    }
+    if (workers == 0) {
+        return true;
+    }
+
+    disk->async_workers = (pthread_t*)calloc(workers, sizeof(pthread_t));
+    if (disk->async_workers == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < workers; i++) {
+        if (pthread_create(&disk->async_workers[i], NULL, disk_async_worker, disk) != 0) {
+            disk->async_nworkers = i;
+            disk_async_setup(disk, 0);
+            return false;
+        }
+    }
+    disk->async_nworkers = workers;
+    return true;
+}
+
+/**
+ * Submit work to the asynchronous pool; a worker runs the work function and
+ * then invokes the completion callback with its result.  Blocks while the
+ * submission queue is full.  Without a pool configured, runs the request
+ * synchronously in the caller so submitters need no fallback path.
+ *
+ * @param       disk            Pointer to Disk structure.
+ * @param       work            Operation to run on a worker.
+ * @param       work_context    Passed to the work function.
+ * @param       callback        Completion callback (may be NULL).
+ * @param       context         Passed to the completion callback.
+ *
+ * @return      Whether or not the request was submitted.
+ **/
+bool    disk_async_submit(Disk *disk, DiskAsyncWork work, void *work_context, DiskAsyncCallback callback, void *context) {
+    assert(disk != NULL);
+    assert(work != NULL);
+    if (disk->async_nworkers == 0) {
+        ssize_t result = work(work_context);
+        if (callback) {
+            callback(result, context);
+        }
+        return true;
+    }
+
+    pthread_mutex_lock(&disk->async_lock);
+    while (disk->async_count == DISK_ASYNC_QUEUE) {
+        pthread_cond_wait(&disk->async_notfull, &disk->async_lock);
+    }
+    DiskAsyncRequest *request = &disk->async_queue[(disk->async_head + disk->async_count) % DISK_ASYNC_QUEUE];
+    request->work         = work;
+    request->work_context = work_context;
+    request->callback     = callback;
+    request->context      = context;
+    disk->async_count++;
+    pthread_cond_signal(&disk->async_notempty);
+    pthread_mutex_unlock(&disk->async_lock);
+    return true;
+}
+
+/**
+ * Submit an asynchronous single block read (same semantics as disk_read; the
+ * callback receives BLOCK_SIZE or DISK_FAILURE).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer (must stay valid until completion).
+ * @param       callback    Completion callback (may be NULL).
+ * @param       context     Passed to the completion callback.
+ *
+ * @return      Whether or not the request was submitted.
+ **/
+bool    disk_read_async(Disk *disk, size_t block, char *data, DiskAsyncCallback callback, void *context) {
+    DiskAsyncBlockOp *op = (DiskAsyncBlockOp*)malloc(sizeof(DiskAsyncBlockOp));
+    if (op == NULL) {
+        return false;
+    }
+    op->disk  = disk;
+    op->block = block;
+    op->data  = data;
+    return disk_async_submit(disk, disk_async_read_work, op, callback, context);
+}
+
+/**
+ * Submit an asynchronous single block write (same semantics as disk_write;
+ * the callback receives BLOCK_SIZE or DISK_FAILURE).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer (must stay valid until completion).
+ * @param       callback    Completion callback (may be NULL).
+ * @param       context     Passed to the completion callback.
+ *
+ * @return      Whether or not the request was submitted.
+ **/
+bool    disk_write_async(Disk *disk, size_t block, char *data, DiskAsyncCallback callback, void *context) {
+    DiskAsyncBlockOp *op = (DiskAsyncBlockOp*)malloc(sizeof(DiskAsyncBlockOp));
+    if (op == NULL) {
+        return false;
+    }
+    op->disk  = disk;
+    op->block = block;
+    op->data  = data;
+    return disk_async_submit(disk, disk_async_write_work, op, callback, context);
+}
+
+/**
+ * Hint that the specified block range will be read soon: a worker pulls the
+ * blocks into the block cache in the background so later disk_read calls hit.
+ *
+ * Speculative transfers do not count against the read/write totals, which
+ * only track what callers actually requested.  A no-op without a worker pool
+ * (synchronous prefetch would just move the stall earlier) or without a
+ * cache.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number in range.
+ * @param       nblocks     Number of consecutive blocks to prefetch.
+ **/
+void    disk_prefetch(Disk *disk, size_t block, size_t nblocks) {
+    assert(disk != NULL);
+    if (disk->async_nworkers == 0 || disk->cache_capacity == 0 ||
+        block >= disk->blocks || nblocks == 0) {
+        return;
+    }
+    if (nblocks > disk->blocks - block) {
+        nblocks = disk->blocks - block;
+    }
+
+    DiskPrefetchOp *op = (DiskPrefetchOp*)malloc(sizeof(DiskPrefetchOp));
+    if (op == NULL) {
+        return;
+    }
+    op->disk    = disk;
+    op->block   = block;
+    op->nblocks = nblocks;
+    disk_async_submit(disk, disk_prefetch_work, op, NULL, NULL);
+}
+
+/**
+ * Block until every submitted request has completed.
+ *
+ * @param       disk        Pointer to Disk structure.
+ **/
+void    disk_async_drain(Disk *disk) {
+    assert(disk != NULL);
+    if (disk->async_nworkers == 0) {
+        return;
+    }
+    pthread_mutex_lock(&disk->async_lock);
+    while (disk->async_count > 0 || disk->async_inflight > 0) {
+        pthread_cond_wait(&disk->async_idle, &disk->async_lock);
+    }
+    pthread_mutex_unlock(&disk->async_lock);
 }
 
 /* Internal Functions */
 
+/**
+ * Worker thread main loop: pull requests off the submission queue, run them,
+ * and fire their completion callbacks until shut down.
+ *
+ * @param       arg         Pointer to Disk structure.
+ *
+ * @return      NULL.
+ **/
+void *  disk_async_worker(void *arg) {
+    Disk *disk = (Disk*)arg;
+
+    while (true) {
+        pthread_mutex_lock(&disk->async_lock);
+        while (disk->async_count == 0 && !disk->async_shutdown) {
+            pthread_cond_wait(&disk->async_notempty, &disk->async_lock);
+        }
+        if (disk->async_count == 0) {
+            pthread_mutex_unlock(&disk->async_lock);
+            break;
+        }
+        DiskAsyncRequest request = disk->async_queue[disk->async_head];
+        disk->async_head = (disk->async_head + 1) % DISK_ASYNC_QUEUE;
+        disk->async_count--;
+        disk->async_inflight++;
+        pthread_cond_signal(&disk->async_notfull);
+        pthread_mutex_unlock(&disk->async_lock);
+
+        ssize_t result = request.work(request.work_context);
+        if (request.callback) {
+            request.callback(result, request.context);
+        }
+
+        pthread_mutex_lock(&disk->async_lock);
+        disk->async_inflight--;
+        if (disk->async_count == 0 && disk->async_inflight == 0) {
+            pthread_cond_broadcast(&disk->async_idle);
+        }
+        pthread_mutex_unlock(&disk->async_lock);
+    }
+    return NULL;
+}
+
+ssize_t disk_async_read_work(void *work_context) {
+    DiskAsyncBlockOp *op = (DiskAsyncBlockOp*)work_context;
+    ssize_t result = disk_read(op->disk, op->block, op->data);
+    free(op);
+    return result;
+}
+
+ssize_t disk_async_write_work(void *work_context) {
+    DiskAsyncBlockOp *op = (DiskAsyncBlockOp*)work_context;
+    ssize_t result = disk_write(op->disk, op->block, op->data);
+    free(op);
+    return result;
+}
+
+ssize_t disk_prefetch_work(void *work_context) {
+    DiskPrefetchOp *op = (DiskPrefetchOp*)work_context;
+    Disk *disk = op->disk;
+
+    for (size_t i = 0; i < op->nblocks; i++) {
+        size_t block = op->block + i;
+        pthread_mutex_lock(&disk->lock);
+        if (disk_cache_lookup(disk, block) != NULL) {
+            pthread_mutex_unlock(&disk->lock);
+            continue;
+        }
+        DiskCacheEntry *entry = disk_cache_evict(disk);
+        if (entry == NULL || disk_physical_read(disk, block, entry->data) == DISK_FAILURE) {
+            pthread_mutex_unlock(&disk->lock);
+            break;
+        }
+        entry->block = block;
+        entry->valid = true;
+        entry->dirty = false;
+        entry->used  = ++disk->cache_clock;
+        pthread_mutex_unlock(&disk->lock);
+    }
+    free(op);
+    return 0;
+}
+
 /**
  * Perform sanity check before read or write operation by doing the following:
  *
@@ -160,4 +1119,210 @@ bool    disk_sanity_check(Disk *disk, size_t block, const char *data) {
     return true;
 }
 
+/**
+ * Read block from the disk image, bypassing the block cache.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer.
+ *
+ * @return      Number of bytes read.
+ *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_physical_read(Disk *disk, size_t block, char *data) {
+    if (disk->mapped) {
+        memcpy(data, disk->mapped + block * BLOCK_SIZE, BLOCK_SIZE);
+        return BLOCK_SIZE;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT && !disk_buffer_aligned(data)) {
+        char *bounce = disk_buffer_alloc(disk);
+        if (bounce == NULL) {
+            return DISK_FAILURE;
+        }
+        ssize_t result = disk_physical_read(disk, block, bounce);
+        if (result != DISK_FAILURE) {
+            memcpy(data, bounce, BLOCK_SIZE);
+        }
+        disk_buffer_free(disk, bounce);
+        return result;
+    }
+    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) == -1) {
+        error("errno: %d\n", errno);
+        return DISK_FAILURE;
+    }
+
+    return read(disk->fd, data, BLOCK_SIZE);
+}
+
+/**
+ * Write block to the disk image, bypassing the block cache.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer.
+ *
+ * @return      Number of bytes written.
+ *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_physical_write(Disk *disk, size_t block, char *data) {
+    if (disk->mapped) {
+        memcpy(disk->mapped + block * BLOCK_SIZE, data, BLOCK_SIZE);
+        return BLOCK_SIZE;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT && !disk_buffer_aligned(data)) {
+        char *bounce = disk_buffer_alloc(disk);
+        if (bounce == NULL) {
+            return DISK_FAILURE;
+        }
+        memcpy(bounce, data, BLOCK_SIZE);
+        ssize_t result = disk_physical_write(disk, block, bounce);
+        disk_buffer_free(disk, bounce);
+        return result;
+    }
+    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) == -1) {
+        error("errno: %d\n", errno);
+        return DISK_FAILURE;
+    }
+
+    return write(disk->fd, data, BLOCK_SIZE);
+}
+
+/**
+ * Read a run of consecutive blocks from the disk image, bypassing the block
+ * cache, retrying on short transfers.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number in range.
+ * @param       nblocks     Number of consecutive blocks to read.
+ * @param       data        Data buffer (nblocks * BLOCK_SIZE bytes).
+ *
+ * @return      Number of bytes read.
+ *              (nblocks * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_physical_readv(Disk *disk, size_t block, size_t nblocks, char *data) {
+    size_t total = nblocks * BLOCK_SIZE;
+    if (disk->mapped) {
+        memcpy(data, disk->mapped + block * BLOCK_SIZE, total);
+        return total;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT && !disk_buffer_aligned(data)) {
+        char *bounce = NULL;
+        if (posix_memalign((void**)&bounce, BLOCK_SIZE, total) != 0) {
+            return DISK_FAILURE;
+        }
+        ssize_t result = disk_physical_readv(disk, block, nblocks, bounce);
+        if (result != DISK_FAILURE) {
+            memcpy(data, bounce, total);
+        }
+        free(bounce);
+        return result;
+    }
+
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = pread(disk->fd, data + done, total - done, block * BLOCK_SIZE + done);
+        if (n <= 0) {
+            error("errno: %d\n", errno);
+            return DISK_FAILURE;
+        }
+        done += n;
+    }
+    return total;
+}
+
+/**
+ * Write a run of consecutive blocks to the disk image, bypassing the block
+ * cache, retrying on short transfers.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number in range.
+ * @param       nblocks     Number of consecutive blocks to write.
+ * @param       data        Data buffer (nblocks * BLOCK_SIZE bytes).
+ *
+ * @return      Number of bytes written.
+ *              (nblocks * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_physical_writev(Disk *disk, size_t block, size_t nblocks, char *data) {
+    size_t total = nblocks * BLOCK_SIZE;
+    if (disk->mapped) {
+        memcpy(disk->mapped + block * BLOCK_SIZE, data, total);
+        return total;
+    }
+    if (disk->backend == DISK_BACKEND_DIRECT && !disk_buffer_aligned(data)) {
+        char *bounce = NULL;
+        if (posix_memalign((void**)&bounce, BLOCK_SIZE, total) != 0) {
+            return DISK_FAILURE;
+        }
+        memcpy(bounce, data, total);
+        ssize_t result = disk_physical_writev(disk, block, nblocks, bounce);
+        free(bounce);
+        return result;
+    }
+
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = pwrite(disk->fd, data + done, total - done, block * BLOCK_SIZE + done);
+        if (n <= 0) {
+            error("errno: %d\n", errno);
+            return DISK_FAILURE;
+        }
+        done += n;
+    }
+    return total;
+}
+
+/**
+ * Search block cache for an entry holding the specified block.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to search for.
+ *
+ * @return      Pointer to matching cache entry (NULL if not cached).
+ **/
+DiskCacheEntry * disk_cache_lookup(Disk *disk, size_t block) {
+    for (size_t i = 0; i < disk->cache_capacity; i++) {
+        DiskCacheEntry *entry = &disk->cache[i];
+        if (entry->valid && entry->block == block) {
+            entry->used = ++disk->cache_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Select a cache entry to hold a new block by doing the following:
+ *
+ *  1. Prefer any entry not currently holding a block.
+ *
+ *  2. Otherwise select the least recently used entry, writing it back first
+ *  if it is dirty.
+ *
+ * @param       disk        Pointer to Disk structure.
+ *
+ * @return      Pointer to usable cache entry (NULL if victim could not be
+ *              written back).
+ **/
+DiskCacheEntry * disk_cache_evict(Disk *disk) {
+    DiskCacheEntry *victim = NULL;
+    for (size_t i = 0; i < disk->cache_capacity; i++) {
+        DiskCacheEntry *entry = &disk->cache[i];
+        if (!entry->valid) {
+            return entry;
+        }
+        if (victim == NULL || entry->used < victim->used) {
+            victim = entry;
+        }
+    }
+
+    if (victim && victim->dirty) {
+        if (disk_physical_write(disk, victim->block, victim->data) == DISK_FAILURE) {
+            return NULL;
+        }
+        victim->dirty = false;
+    }
+    victim->valid = false;
+    return victim;
+}
+
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
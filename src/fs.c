@@ -1,7 +1,10 @@
 /* fs.c: SimpleFS file system */
 
+#include "sfs/checksum.h"
+#include "sfs/compress.h"
 #include "sfs/fs.h"
 #include "sfs/logging.h"
+#include "sfs/stats.h"
 #include "sfs/utils.h"
 
 #include <stdio.h>
@@ -9,6 +12,83 @@
 #include <assert.h>
 #include <math.h>
 
+/* Internal Constants */
+
+#define FS_FORMAT_CHUNK (64)    /* Blocks cleared per vectored write during format */
+
+/* Internal Prototypes */
+
+bool    fs_do_mount(FileSystem *fs, Disk *disk);
+ssize_t fs_do_create(FileSystem *fs);
+bool    fs_do_remove(FileSystem *fs, size_t inode_number);
+ssize_t fs_do_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
+ssize_t fs_do_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
+void    fs_bitmap_reserve(FileSystem *fs, size_t block);
+void    fs_bitmap_release(FileSystem *fs, size_t block);
+ssize_t fs_group_find_free(FileSystem *fs, size_t group);
+uint32_t fs_inode_block(FileSystem *fs, Inode *node, Block *indirect, bool *indirect_loaded, size_t logical);
+uint32_t fs_allocate_block(FileSystem *fs, Inode *node, Block *indirect, bool *indirect_loaded, bool *indirect_dirty, size_t logical);
+ssize_t fs_bitmap_acquire(FileSystem *fs, size_t hint);
+ssize_t fs_bitmap_acquire_cluster(FileSystem *fs, size_t hint);
+size_t  fs_allocation_hint(FileSystem *fs, Inode *node, Block *indirect, bool indirect_loaded);
+pthread_rwlock_t *fs_inode_lock(FileSystem *fs, size_t inode_number);
+size_t  fs_extent_blocks(Block *indirect);
+bool    fs_extent_append(Block *indirect, uint32_t block);
+bool    fs_extent_append_hole(Block *indirect, uint32_t length);
+uint32_t fs_extent_fill(FileSystem *fs, Block *indirect, size_t target);
+void    fs_readahead(FileSystem *fs, size_t inode_number, Inode *node, Block *indirect, bool *indirect_loaded, size_t offset, size_t length);
+ssize_t fs_async_read_work(void *work_context);
+ssize_t fs_async_write_work(void *work_context);
+bool    fs_async_submit(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, bool write, FileSystemCallback callback, void *context);
+bool    fs_load_free_block_bitmap(FileSystem *fs);
+bool    fs_store_free_block_bitmap(FileSystem *fs);
+bool    fs_write_superblock(FileSystem *fs);
+size_t  fs_lengths_blocks(SuperBlock *sb);
+size_t  fs_checksum_blocks(SuperBlock *sb);
+bool    fs_checksum_verify(FileSystem *fs, uint32_t block, const char *data);
+size_t  fs_journal_base(SuperBlock *sb);
+bool    fs_journal_append(FileSystem *fs, uint32_t type, uint32_t number, Inode *node);
+bool    fs_journal_flush_locked(FileSystem *fs);
+bool    fs_journal_checkpoint_locked(FileSystem *fs);
+void    fs_journal_replay(FileSystem *fs);
+
+/* Internal Constants */
+
+#define JOURNAL_MAGIC       (0xf0f0444a)        /* Marks a valid journal block */
+#define JOURNAL_ENTRY_INODE (1)                 /* Inode table update */
+#define JOURNAL_ENTRY_ALLOC (2)                 /* Block taken from the free bitmap */
+#define JOURNAL_ENTRY_FREE  (3)                 /* Block returned to the free bitmap */
+
+/* Internal Structures */
+
+typedef struct JournalEntry JournalEntry;
+struct JournalEntry {
+    uint32_t    type;                           /* JOURNAL_ENTRY_* */
+    uint32_t    number;                         /* Inode or block number */
+    Inode       inode;                          /* New contents (JOURNAL_ENTRY_INODE only) */
+};
+
+typedef struct JournalBlock JournalBlock;
+struct JournalBlock {
+    uint32_t    magic;                          /* JOURNAL_MAGIC */
+    uint32_t    sequence;                       /* Position in the journal stream */
+    uint32_t    count;                          /* Number of live entries */
+    uint32_t    checksum;                       /* CRC32C of the entry area */
+    JournalEntry entries[(BLOCK_SIZE - 4 * sizeof(uint32_t)) / sizeof(JournalEntry)];
+};
+
+#define JOURNAL_ENTRIES ((BLOCK_SIZE - 4 * sizeof(uint32_t)) / sizeof(JournalEntry))
+
+typedef struct FileSystemAsyncOp FileSystemAsyncOp;
+
+struct FileSystemAsyncOp {
+    FileSystem *fs;
+    size_t      inode_number;
+    char       *data;
+    size_t      length;
+    size_t      offset;
+};
+
 /* External Functions */
 
 /**
@@ -29,7 +109,8 @@ void    fs_debug(Disk *disk) {
     }
 
     printf("SuperBlock:\n");
-    printf("    magic number is %s\n", block.super.magic_number == MAGIC_NUMBER ? "valid" : "invalid");
+    printf("    magic number is %s\n", block.super.magic_number == MAGIC_NUMBER ||
+                                        block.super.magic_number == MAGIC_NUMBER_V2 ? "valid" : "invalid");
     printf("    %u blocks\n"         , block.super.blocks);
     printf("    %u inode blocks\n"   , block.super.inode_blocks);
     printf("    %u inodes\n"         , block.super.inodes);
@@ -45,16 +126,40 @@ void    fs_debug(Disk *disk) {
         // Iterate through all inodes in block
         for (int j = 0; j < INODES_PER_BLOCK; j++) {
             Inode inode = blk.inodes[j];
-            if (inode.valid == 1) {
-                uint32_t inode_number = (i - 1) * INODES_PER_BLOCK + j;
-                int pointers = 0;
-                for (int k = 0; k < POINTERS_PER_INODE; k++) {
-                    if (inode.direct[k] == 0) continue;
-                    pointers++;
+            if (inode.valid != 1) continue;
+
+            uint32_t inode_number = (i - 1) * INODES_PER_BLOCK + j;
+            printf("Inode %u:\n", inode_number);
+            printf("    size: %u bytes\n", inode.size);
+            printf("    direct blocks:");
+            for (int k = 0; k < POINTERS_PER_INODE; k++) {
+                if (inode.direct[k] == 0) continue;
+                printf(" %u", inode.direct[k]);
+            }
+            printf("\n");
+
+            if (inode.indirect != 0) {
+                printf("    indirect block: %u\n", inode.indirect);
+                Block indirect;
+                if (disk_read(disk, inode.indirect, indirect.data) == DISK_FAILURE) {
+                    error("Error reading indirect block %u\n", inode.indirect);
+                    return;
+                }
+                printf("    indirect data blocks:");
+                if (block.super.magic_number == MAGIC_NUMBER_V2) {
+                    for (int k = 0; k < EXTENTS_PER_BLOCK && indirect.extents[k].length; k++) {
+                        if (indirect.extents[k].start == 0) continue;  /* hole */
+                        for (uint32_t b = 0; b < indirect.extents[k].length; b++) {
+                            printf(" %u", indirect.extents[k].start + b);
+                        }
+                    }
+                } else {
+                    for (int k = 0; k < POINTERS_PER_BLOCK; k++) {
+                        if (indirect.pointers[k] == 0) continue;
+                        printf(" %u", indirect.pointers[k]);
+                    }
                 }
-                printf("Inode %d\n", inode_number);
-                printf("    size: %d bytes\n", inode.size);
-                printf("    direct blocks: %d\n", pointers);
+                printf("\n");
             }
         }
     }
@@ -75,42 +180,219 @@ void    fs_debug(Disk *disk) {
  * @return      Whether or not all disk operations were successful.
  **/
 bool    fs_format(FileSystem *fs, Disk *disk) {
+    return fs_format_clustered(fs, disk, 1);
+}
+
+/**
+ * Format Disk with the specified allocation unit: data blocks in the extent
+ * region are claimed cluster_blocks at a time, so large sequential files
+ * carry 1/cluster_blocks of the allocator and extent bookkeeping.  A cluster
+ * size of 1 (the fs_format default) matches existing images.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       disk            Pointer to Disk structure.
+ * @param       cluster_blocks  Allocation unit in blocks.
+ * @return      Whether or not all disk operations were successful.
+ **/
+bool    fs_format_clustered(FileSystem *fs, Disk *disk, size_t cluster_blocks) {
+    return fs_format_compressed(fs, disk, cluster_blocks, false);
+}
+
+/**
+ * Format Disk with transparent per-block compression as an option: each data
+ * block is stored compressed when that wins, raw otherwise, with the
+ * compressed length kept in a per-block map region between the free bitmap
+ * and the data region.  Reads and writes of compressed blocks then transfer
+ * only the compressed bytes.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       disk            Pointer to Disk structure.
+ * @param       cluster_blocks  Allocation unit in blocks.
+ * @param       compressed      Whether to store data blocks compressed.
+ * @return      Whether or not all disk operations were successful.
+ **/
+bool    fs_format_compressed(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed) {
+    return fs_format_checksummed(fs, disk, cluster_blocks, compressed, false);
+}
+
+/**
+ * Format Disk with per-block CRC32C checksums as an option: every data block
+ * write records the checksum of the block's logical contents in a per-block
+ * region after the compressed lengths map, every read verifies it, and the
+ * sfssh verify command checks a whole image with streaming reads.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       disk            Pointer to Disk structure.
+ * @param       cluster_blocks  Allocation unit in blocks.
+ * @param       compressed      Whether to store data blocks compressed.
+ * @param       checksummed     Whether to keep per-block checksums.
+ * @return      Whether or not all disk operations were successful.
+ **/
+bool    fs_format_checksummed(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed, bool checksummed) {
+    return fs_format_journaled(fs, disk, cluster_blocks, compressed, checksummed, false);
+}
+
+/**
+ * Format Disk with a metadata journal as an option: inode table updates and
+ * free bitmap deltas append to a small journal region instead of being
+ * written to their scattered home locations, with records from concurrent
+ * operations group-committed into shared journal blocks.  The journal
+ * checkpoints back to the home locations when it fills, and fs_mount replays
+ * it instead of falling back to the full-image scan after a crash.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       disk            Pointer to Disk structure.
+ * @param       cluster_blocks  Allocation unit in blocks.
+ * @param       compressed      Whether to store data blocks compressed.
+ * @param       checksummed     Whether to keep per-block checksums.
+ * @param       journaled       Whether to journal metadata updates.
+ * @return      Whether or not all disk operations were successful.
+ **/
+bool    fs_format_journaled(FileSystem *fs, Disk *disk, size_t cluster_blocks, bool compressed, bool checksummed, bool journaled) {
     assert(fs != NULL);
     assert(disk != NULL);
+    if (fs->disk != NULL) {
+        return false;
+    }
+    if (cluster_blocks == 0 || cluster_blocks > FS_GROUP_BLOCKS) {
+        error("[fs_format] invalid cluster size %zu\n", cluster_blocks);
+        return false;
+    }
     uint32_t inodes = ceil(disk->blocks * 0.1);
+    uint32_t bitmap_blocks = (disk->blocks + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8);
     SuperBlock sp = {
-        .magic_number = MAGIC_NUMBER,
+        .magic_number = MAGIC_NUMBER_V2,
         .blocks = disk->blocks,
         .inode_blocks = inodes,
         .inodes = inodes * INODES_PER_BLOCK,
+        .bitmap_blocks = bitmap_blocks,
+        .bitmap_clean = 1,
+        .group_blocks = FS_GROUP_BLOCKS,
+        .cluster_blocks = cluster_blocks,
+        .compression = compressed,
+        .checksums = checksummed,
+        .journal_blocks = journaled ? FS_JOURNAL_BLOCKS : 0,
+        .journal_sequence = 1,
     };
     Block blk;
+    memset(blk.data, 0, BLOCK_SIZE);
     blk.super = sp;
     if (disk_write(disk, 0, blk.data) == DISK_FAILURE) {
         error("[fs_format]\n");
         return false;
     };
 
-    // Create inode block
-    Inode inode = {
-        .valid = 0,
-        .size = 0,
-        .indirect = 0,
-    };
-    memset(inode.direct, 0, POINTERS_PER_INODE * sizeof(int));
-    assert(sizeof(inode) == BLOCK_SIZE / INODES_PER_BLOCK);
+    // Clear the inode table with large vectored writes rather than one
+    // disk_write per block, so format time scales with metadata size
+    size_t chunk = min(FS_FORMAT_CHUNK, (size_t)inodes);
+    char *zeros = calloc(chunk, BLOCK_SIZE);
+    if (zeros == NULL) {
+        return false;
+    }
+    for (size_t i = 1; i <= inodes; i += chunk) {
+        size_t run = min(chunk, inodes - i + 1);
+        if (disk_writev(disk, i, run, zeros) == DISK_FAILURE) {
+            error("[fs_format]\n");
+            free(zeros);
+            return false;
+        }
+    }
+    free(zeros);
+
+    // Write initial free bitmap: everything past the reserved regions is free
+    size_t lengths_blocks  = fs_lengths_blocks(&sp);
+    size_t checksum_blocks = fs_checksum_blocks(&sp);
+    uint64_t *bitmap = (uint64_t*)calloc(bitmap_blocks, BLOCK_SIZE);
+    if (bitmap == NULL) {
+        return false;
+    }
+    for (size_t b = 1 + inodes + bitmap_blocks + lengths_blocks + checksum_blocks + sp.journal_blocks; b < disk->blocks; b++) {
+        bitmap[b / 64] |= 1ULL << (b % 64);
+    }
+    if (disk_writev(disk, 1 + inodes, bitmap_blocks, (char*)bitmap) == DISK_FAILURE) {
+        error("[fs_format]\n");
+        free(bitmap);
+        return false;
+    }
+    free(bitmap);
 
-    for (int i = 0; i < INODES_PER_BLOCK; i++) {
-        blk.inodes[i] = inode;
+    // Zero the compressed lengths map (everything starts raw)
+    if (lengths_blocks > 0) {
+        char *lengths = calloc(lengths_blocks, BLOCK_SIZE);
+        if (lengths == NULL) {
+            return false;
+        }
+        if (disk_writev(disk, 1 + inodes + bitmap_blocks, lengths_blocks, lengths) == DISK_FAILURE) {
+            error("[fs_format]\n");
+            free(lengths);
+            return false;
+        }
+        free(lengths);
+    }
+
+    // Zero the checksum region (no block has been written yet)
+    if (checksum_blocks > 0) {
+        char *checksums = calloc(checksum_blocks, BLOCK_SIZE);
+        if (checksums == NULL) {
+            return false;
+        }
+        if (disk_writev(disk, 1 + inodes + bitmap_blocks + lengths_blocks, checksum_blocks, checksums) == DISK_FAILURE) {
+            error("[fs_format]\n");
+            free(checksums);
+            return false;
+        }
+        free(checksums);
     }
-    assert(sizeof(blk) == BLOCK_SIZE);
 
-    for (int i = 1; i <= inodes; i++) {
-        if (disk_write(disk, i, blk.data) == DISK_FAILURE) {
+    // Zero the journal region (no record matches the starting sequence)
+    if (sp.journal_blocks > 0) {
+        char *journal = calloc(sp.journal_blocks, BLOCK_SIZE);
+        if (journal == NULL) {
+            return false;
+        }
+        if (disk_writev(disk, 1 + inodes + bitmap_blocks + lengths_blocks + checksum_blocks,
+                        sp.journal_blocks, journal) == DISK_FAILURE) {
             error("[fs_format]\n");
+            free(journal);
             return false;
         }
+        free(journal);
+    }
+    return true;
+}
+
+/**
+ * Size of the compressed lengths map region in blocks (one uint16 per block;
+ * zero when the image does not use compression).
+ **/
+size_t fs_lengths_blocks(SuperBlock *sb) {
+    if (!sb->compression) {
+        return 0;
+    }
+    return ((size_t)sb->blocks * sizeof(uint16_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/**
+ * Size of the checksum region in blocks (one uint32 per block; zero when the
+ * image does not keep checksums).
+ **/
+size_t fs_checksum_blocks(SuperBlock *sb) {
+    if (!sb->checksums) {
+        return 0;
+    }
+    return ((size_t)sb->blocks * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/**
+ * Check a block's contents against its recorded checksum (blocks that were
+ * never written carry no checksum and always pass).
+ **/
+bool fs_checksum_verify(FileSystem *fs, uint32_t block, const char *data) {
+    uint32_t expected = fs->block_checksums[block];
+    if (expected == 0 || checksum_block(data, BLOCK_SIZE) == expected) {
+        return true;
     }
+    error("[fs_read] checksum mismatch on block %u\n", block);
     return false;
 }
 
@@ -123,7 +405,10 @@ bool    fs_format(FileSystem *fs, Disk *disk) {
  *
  *  3. Copy SuperBlock to FileSystem meta data attribute
  *
- *  4. Initialize FileSystem free blocks bitmap.
+ *  4. Read the whole Inode Table into memory so later inode lookups never
+ *  touch the disk.
+ *
+ *  5. Initialize FileSystem free blocks bitmap.
  *
  * Note: Do not mount a Disk that has already been mounted!
  *
@@ -132,46 +417,306 @@ bool    fs_format(FileSystem *fs, Disk *disk) {
  * @return      Whether or not the mount operation was successful.
  **/
 bool    fs_mount(FileSystem *fs, Disk *disk) {
+    uint64_t start = stats_time();
+    bool result = fs_do_mount(fs, disk);
+    stats_record(STATS_FS_MOUNT, start);
+    return result;
+}
+
+bool    fs_do_mount(FileSystem *fs, Disk *disk) {
     assert(fs != NULL);
     assert(disk != NULL);
+    if (fs->disk != NULL) {
+        return false;
+    }
+
     Block blk;
     if (disk_read(disk, 0, blk.data) == DISK_FAILURE) {
         error("[fs_mount] error reading super block\n");
         return false;
     }
 
-    if (blk.super.magic_number != MAGIC_NUMBER) {
+    if ((blk.super.magic_number != MAGIC_NUMBER && blk.super.magic_number != MAGIC_NUMBER_V2) ||
+        blk.super.blocks != disk->blocks ||
+        blk.super.inodes != blk.super.inode_blocks * INODES_PER_BLOCK) {
+        return false;
+    }
+    /* Grown v2 images keep the inode table sized for the formatted blocks */
+    if (blk.super.inode_blocks != (uint32_t)ceil(disk->blocks * 0.1) &&
+        (blk.super.magic_number != MAGIC_NUMBER_V2 ||
+         blk.super.inode_blocks == 0 ||
+         blk.super.inode_blocks > (uint32_t)ceil(disk->blocks * 0.1))) {
         return false;
     }
     fs->disk = disk;
     memcpy(&fs->meta_data, &blk.super, sizeof(SuperBlock));
 
-    fs_initialize_free_block_bitmap(fs);
-    return false;
+    for (size_t i = 0; i < FS_LOCK_STRIPES; i++) {
+        pthread_rwlock_init(&fs->inode_locks[i], NULL);
+    }
+    pthread_mutex_init(&fs->itable_lock, NULL);
+    pthread_mutex_init(&fs->ra_lock, NULL);
+    pthread_mutex_init(&fs->journal_lock, NULL);
+    pthread_mutex_init(&fs->handle_lock, NULL);
+    memset(fs->handles, 0, sizeof(fs->handles));
+    memset(fs->journal_buffer.data, 0, BLOCK_SIZE);
+    fs->journal_head = 0;
+    fs->journal_sequence = fs->meta_data.journal_sequence;
+    fs->journal_ready = false;
+    fs->ra_inode  = (size_t)-1;
+    fs->ra_offset = 0;
+    fs->ra_window = FS_READAHEAD_WINDOW;
+
+    /* Allocation groups: legacy images (group_blocks 0) get one group
+     * spanning the whole disk, which degenerates to the old behavior */
+    fs->group_blocks = fs->meta_data.group_blocks ? fs->meta_data.group_blocks : fs->meta_data.blocks;
+    fs->group_count  = (fs->meta_data.blocks + fs->group_blocks - 1) / fs->group_blocks;
+    fs->cluster_blocks = fs->meta_data.cluster_blocks ? fs->meta_data.cluster_blocks : 1;
+
+    /* Size allocation arrays for the bitmap region's full capacity so that
+     * fs_grow can extend them in place without moving any pointers */
+    size_t capacity_blocks = fs->meta_data.bitmap_blocks ?
+        (size_t)fs->meta_data.bitmap_blocks * BLOCK_SIZE * 8 : fs->meta_data.blocks;
+    size_t capacity_groups = (capacity_blocks + fs->group_blocks - 1) / fs->group_blocks;
+    fs->group_free   = (size_t*)calloc(capacity_groups, sizeof(size_t));
+    if (fs->group_free == NULL) {
+        fs->disk = NULL;
+        return false;
+    }
+    for (size_t i = 0; i < FS_GROUP_LOCKS; i++) {
+        pthread_mutex_init(&fs->group_locks[i], NULL);
+    }
+
+    fs->inode_table = (Block*)malloc((size_t)fs->meta_data.inode_blocks * BLOCK_SIZE);
+    if (fs->inode_table == NULL) {
+        fs->disk = NULL;
+        return false;
+    }
+    if (disk_readv(disk, 1, fs->meta_data.inode_blocks, fs->inode_table->data) == DISK_FAILURE) {
+        error("[fs_mount] error reading inode table\n");
+        free(fs->inode_table);
+        fs->inode_table = NULL;
+        fs->disk = NULL;
+        return false;
+    }
+
+    /* Journaled images always start from the checkpointed bitmap and replay
+     * the journal on top, so a crash never forces the full-image scan.
+     * Otherwise prefer the persisted bitmap when it was cleanly unmounted,
+     * marking it dirty so a crash forces the scan on the next mount */
+    if (fs->meta_data.journal_blocks > 0 && fs_load_free_block_bitmap(fs)) {
+        fs_journal_replay(fs);
+    } else if (fs->meta_data.bitmap_blocks > 0 && fs->meta_data.bitmap_clean &&
+        fs_load_free_block_bitmap(fs)) {
+        fs->meta_data.bitmap_clean = 0;
+        fs_write_superblock(fs);
+    } else if (!fs_initialize_free_block_bitmap(fs)) {
+        free(fs->inode_table);
+        fs->inode_table = NULL;
+        free(fs->group_free);
+        fs->group_free = NULL;
+        fs->disk = NULL;
+        return false;
+    }
+
+    /* Load the compressed lengths map (compressed images only) */
+    if (fs->meta_data.compression) {
+        size_t lengths_blocks = fs_lengths_blocks(&fs->meta_data);
+        fs->block_lengths = (uint16_t*)malloc(lengths_blocks * BLOCK_SIZE);
+        if (fs->block_lengths == NULL ||
+            disk_readv(disk, 1 + fs->meta_data.inode_blocks + fs->meta_data.bitmap_blocks,
+                       lengths_blocks, (char*)fs->block_lengths) == DISK_FAILURE) {
+            error("[fs_mount] error reading lengths map\n");
+            free(fs->block_lengths);
+            fs->block_lengths = NULL;
+            free(fs->inode_table);
+            fs->inode_table = NULL;
+            free(fs->group_free);
+            fs->group_free = NULL;
+            free(fs->free_blocks);
+            fs->free_blocks = NULL;
+            fs->disk = NULL;
+            return false;
+        }
+    }
+
+    /* Load the per-block checksums (checksummed images only) */
+    if (fs->meta_data.checksums) {
+        size_t checksum_blocks = fs_checksum_blocks(&fs->meta_data);
+        fs->block_checksums = (uint32_t*)malloc(checksum_blocks * BLOCK_SIZE);
+        if (fs->block_checksums == NULL ||
+            disk_readv(disk, 1 + fs->meta_data.inode_blocks + fs->meta_data.bitmap_blocks +
+                       fs_lengths_blocks(&fs->meta_data),
+                       checksum_blocks, (char*)fs->block_checksums) == DISK_FAILURE) {
+            error("[fs_mount] error reading checksum region\n");
+            free(fs->block_checksums);
+            fs->block_checksums = NULL;
+            free(fs->block_lengths);
+            fs->block_lengths = NULL;
+            free(fs->inode_table);
+            fs->inode_table = NULL;
+            free(fs->group_free);
+            fs->group_free = NULL;
+            free(fs->free_blocks);
+            fs->free_blocks = NULL;
+            fs->disk = NULL;
+            return false;
+        }
+    }
+
+    /* Rebuild free inode accounting so fs_create never rescans from 0 */
+    fs->free_inode_hint = fs->meta_data.inodes;
+    fs->free_inode_count = 0;
+    for (uint32_t i = 0; i < fs->meta_data.inodes; i++) {
+        if (fs->inode_table[i / INODES_PER_BLOCK].inodes[i % INODES_PER_BLOCK].valid) {
+            continue;
+        }
+        if (i < fs->free_inode_hint) {
+            fs->free_inode_hint = i;
+        }
+        fs->free_inode_count++;
+    }
+    fs->journal_ready = fs->meta_data.journal_blocks > 0;
+    return true;
 }
 
 /**
  * Unmount FileSystem from internal Disk by doing the following:
  *
- *  1. Set FileSystem disk attribute.
+ *  1. Persist the free blocks bitmap and mark it clean (images with a bitmap
+ *  region only).
  *
- *  2. Release free blocks bitmap.
+ *  2. Set FileSystem disk attribute.
+ *
+ *  3. Release free blocks bitmap.
  *
  * @param       fs      Pointer to FileSystem structure.
  **/
 void    fs_unmount(FileSystem *fs) {
     assert(fs != NULL);
-    assert(fs->free_blocks != NULL);
+    if (fs->disk == NULL) {
+        return;
+    }
+    if (fs->meta_data.journal_blocks > 0) {
+        pthread_mutex_lock(&fs->journal_lock);
+        fs->journal_ready = false;
+        fs_journal_flush_locked(fs);
+        fs_journal_checkpoint_locked(fs);
+        pthread_mutex_unlock(&fs->journal_lock);
+    }
+    if (fs->meta_data.bitmap_blocks > 0 && fs_store_free_block_bitmap(fs)) {
+        fs->meta_data.bitmap_clean = 1;
+        fs_write_superblock(fs);
+    }
+    for (size_t i = 0; i < FS_LOCK_STRIPES; i++) {
+        pthread_rwlock_destroy(&fs->inode_locks[i]);
+    }
+    pthread_mutex_destroy(&fs->itable_lock);
+    for (size_t i = 0; i < FS_GROUP_LOCKS; i++) {
+        pthread_mutex_destroy(&fs->group_locks[i]);
+    }
+    pthread_mutex_destroy(&fs->ra_lock);
+    pthread_mutex_destroy(&fs->journal_lock);
+    pthread_mutex_destroy(&fs->handle_lock);
+    free(fs->group_free);
+    fs->group_free = NULL;
+    free(fs->block_lengths);
+    fs->block_lengths = NULL;
+    free(fs->block_checksums);
+    fs->block_checksums = NULL;
     free(fs->free_blocks);
+    fs->free_blocks = NULL;
+    fs->free_block_count = 0;
+    free(fs->inode_table);
+    fs->inode_table = NULL;
     fs->disk = NULL;
 }
 
+/**
+ * Grow a mounted FileSystem to a larger number of blocks by doing the
+ * following:
+ *
+ *  1. Check that the image carries a persisted bitmap region and that the new
+ *  size still fits in the metadata regions reserved at format time (the
+ *  bitmap and, on compressed images, the lengths map cannot be relocated).
+ *
+ *  2. Extend the backing disk image.
+ *
+ *  3. Release the new blocks into the free bitmap, extending the allocation
+ *  groups to cover them, while holding every group lock to exclude
+ *  concurrent allocators.
+ *
+ *  4. Record the new block count in the SuperBlock.
+ *
+ * The inode table keeps its formatted size, so growing adds data capacity
+ * but no inodes.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       new_blocks  New number of blocks (must exceed current count).
+ *
+ * @return      Whether or not the grow operation was successful.
+ **/
+bool    fs_grow(FileSystem *fs, size_t new_blocks) {
+    assert(fs != NULL);
+    if (fs->disk == NULL || new_blocks <= fs->meta_data.blocks) {
+        error("[fs_grow] invalid number of blocks: %zu\n", new_blocks);
+        return false;
+    }
+    if (fs->meta_data.bitmap_blocks == 0) {
+        error("[fs_grow] image has no bitmap region; reformat required\n");
+        return false;
+    }
+    if (new_blocks > (size_t)fs->meta_data.bitmap_blocks * BLOCK_SIZE * 8) {
+        error("[fs_grow] bitmap region too small for %zu blocks\n", new_blocks);
+        return false;
+    }
+    if (fs->meta_data.compression || fs->meta_data.checksums) {
+        SuperBlock grown = fs->meta_data;
+        grown.blocks = new_blocks;
+        if (fs_lengths_blocks(&grown) > fs_lengths_blocks(&fs->meta_data) ||
+            fs_checksum_blocks(&grown) > fs_checksum_blocks(&fs->meta_data)) {
+            error("[fs_grow] metadata regions too small for %zu blocks\n", new_blocks);
+            return false;
+        }
+    }
+
+    if (!disk_grow(fs->disk, new_blocks)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < FS_GROUP_LOCKS; i++) {
+        pthread_mutex_lock(&fs->group_locks[i]);
+    }
+    size_t old_blocks = fs->meta_data.blocks;
+    size_t new_groups = (new_blocks + fs->group_blocks - 1) / fs->group_blocks;
+    for (size_t g = fs->group_count; g < new_groups; g++) {
+        fs->group_free[g] = 0;
+    }
+    fs->group_count = new_groups;
+    fs->meta_data.blocks = new_blocks;
+    for (size_t b = old_blocks; b < new_blocks; b++) {
+        uint64_t mask  = 1ULL << (b % 64);
+        size_t   group = b / fs->group_blocks;
+        fs->free_blocks[b / 64] |= mask;
+        fs->group_free[group]++;
+        __atomic_fetch_add(&fs->free_block_count, 1, __ATOMIC_RELAXED);
+    }
+    for (size_t i = 0; i < FS_GROUP_LOCKS; i++) {
+        pthread_mutex_unlock(&fs->group_locks[i]);
+    }
+
+    return fs_write_superblock(fs);
+}
+
 /**
  * Allocate an Inode in the FileSystem Inode table by doing the following:
  *
- *  1. Search Inode table for free inode.
+ *  1. Fail fast if the free inode count says the table is full.
+ *
+ *  2. Search Inode table from the free inode hint, which never skips a free
+ *  inode because fs_remove pulls it back down.
  *
- *  2. Reserve free inode in Inode table.
+ *  3. Reserve free inode in Inode table and advance the hint past it.
  *
  * Note: Be sure to record updates to Inode table to Disk.
  *
@@ -179,28 +724,49 @@ void    fs_unmount(FileSystem *fs) {
  * @return      Inode number of allocated Inode.
  **/
 ssize_t fs_create(FileSystem *fs) {
+    uint64_t start = stats_time();
+    ssize_t result = fs_do_create(fs);
+    stats_record(STATS_FS_CREATE, start);
+    if (result >= 0) {
+        trace_record(STATS_FS_CREATE, result, 0, 0);
+    }
+    return result;
+}
+
+ssize_t fs_do_create(FileSystem *fs) {
     assert(fs != NULL);
     assert(fs->disk != NULL);
-    int inode = -1;
-    for (int i = 1; i <= fs->meta_data.inode_blocks; i++) {
-        Block blk;
-        if (disk_read(fs->disk, i, blk.data) != DISK_FAILURE) {
-            error("[fs_create] read disk failure\n");
-            return -1;
+
+    Inode node = {
+        .valid = 1,
+        .size = 0,
+        .indirect = 0,
+    };
+    memset(node.direct, 0, sizeof(node.direct));
+
+    /* Claim the inode in memory under the table lock so no other thread can
+     * pick it, then persist the table block outside the scan */
+    pthread_mutex_lock(&fs->itable_lock);
+    if (fs->free_inode_count == 0) {
+        pthread_mutex_unlock(&fs->itable_lock);
+        return -1;
+    }
+    for (size_t i = fs->free_inode_hint; i < fs->meta_data.inodes; i++) {
+        if (fs->inode_table[i / INODES_PER_BLOCK].inodes[i % INODES_PER_BLOCK].valid) {
+            continue;
         }
 
-        for (int j = 0; j < INODES_PER_BLOCK; j++) {
-            if (blk.inodes[j].valid == false) {
-                blk.inodes[j].valid = true;
-                inode = (i - 1) * INODES_PER_BLOCK + j;
-                if (disk_write(fs->disk, i, blk.data) == DISK_FAILURE) {
-                    return -1;
-                }
+        fs->inode_table[i / INODES_PER_BLOCK].inodes[i % INODES_PER_BLOCK] = node;
+        fs->free_inode_hint = i + 1;
+        fs->free_inode_count--;
+        pthread_mutex_unlock(&fs->itable_lock);
 
-                return inode;
-            }
+        if (!fs_save_inode(fs, i, &node)) {
+            return -1;
         }
+        return i;
     }
+    pthread_mutex_unlock(&fs->itable_lock);
 
     return -1;
 }
@@ -221,45 +787,83 @@ ssize_t fs_create(FileSystem *fs) {
  * @return      Whether or not removing the specified Inode was successful.
  **/
 bool    fs_remove(FileSystem *fs, size_t inode_number) {
+    uint64_t start = stats_time();
+
+    /* Pinned inodes cannot be removed */
+    pthread_mutex_lock(&fs->handle_lock);
+    for (size_t i = 0; i < FS_HANDLE_MAX; i++) {
+        if (fs->handles[i].fs == fs && fs->handles[i].inode_number == inode_number) {
+            pthread_mutex_unlock(&fs->handle_lock);
+            error("[fs_remove] inode %zu is pinned by an open handle\n", inode_number);
+            stats_record(STATS_FS_REMOVE, start);
+            return false;
+        }
+    }
+    pthread_mutex_unlock(&fs->handle_lock);
+
+    pthread_rwlock_t *lock = fs_inode_lock(fs, inode_number);
+    if (lock) pthread_rwlock_wrlock(lock);
+    bool result = fs_do_remove(fs, inode_number);
+    if (lock) pthread_rwlock_unlock(lock);
+    stats_record(STATS_FS_REMOVE, start);
+    trace_record(STATS_FS_REMOVE, inode_number, 0, 0);
+    return result;
+}
+
+bool    fs_do_remove(FileSystem *fs, size_t inode_number) {
     // Load Inode
-    Inode* in = NULL;
-    bool res = fs_load_inode(fs, inode_number, in);
-    if (!res) {
+    Inode in;
+    if (!fs_load_inode(fs, inode_number, &in)) {
         return false;
     }
 
     // Release direct blocks
     for (int i = 0; i < POINTERS_PER_INODE; i++) {
-        int num = in->direct[i];
-        if (num == 0) continue;
+        if (in.direct[i] == 0) continue;
 
-        fs->free_blocks[num] = false;
-        in->direct[i] = 0;
+        fs_bitmap_release(fs, in.direct[i]);
+        in.direct[i] = 0;
     }
 
-    // Release indirect blocks
-    if (in->size > BLOCK_SIZE * POINTERS_PER_INODE) {
-        assert(in->indirect > 0);
+    // Release indirect pointer blocks and the indirect block itself
+    if (in.indirect != 0) {
         Block indirect;
-        if (disk_read(fs->disk, in->indirect, indirect.data) == DISK_FAILURE) {
+        if (disk_read(fs->disk, in.indirect, indirect.data) == DISK_FAILURE) {
             error("[fs_remove] error in reading indirect block\n");
-            free(in);
             return false;
         }
 
-        for (int i = 0; i < POINTERS_PER_BLOCK; i++) {
-            int num = indirect.pointers[i];
-            if (num == 0) continue;
+        if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+            for (int i = 0; i < EXTENTS_PER_BLOCK && indirect.extents[i].length; i++) {
+                if (indirect.extents[i].start == 0) continue;  /* hole */
+                for (uint32_t b = 0; b < indirect.extents[i].length; b++) {
+                    fs_bitmap_release(fs, indirect.extents[i].start + b);
+                }
+            }
+        } else {
+            for (int i = 0; i < POINTERS_PER_BLOCK; i++) {
+                if (indirect.pointers[i] == 0) continue;
 
-            fs->free_blocks[num] = false;
+                fs_bitmap_release(fs, indirect.pointers[i]);
+            }
         }
+        fs_bitmap_release(fs, in.indirect);
+        in.indirect = 0;
+    }
+
+    in.valid = false;
+    in.size = 0;
+    if (!fs_save_inode(fs, inode_number, &in)) {
+        return false;
     }
 
-    in->valid = false;
-    in->indirect = 0;
-    res = fs_save_inode(fs, inode_number, in);
-    free(in);
-    return res;
+    pthread_mutex_lock(&fs->itable_lock);
+    if (inode_number < fs->free_inode_hint) {
+        fs->free_inode_hint = inode_number;
+    }
+    fs->free_inode_count++;
+    pthread_mutex_unlock(&fs->itable_lock);
+    return true;
 }
 
 /**
@@ -270,24 +874,79 @@ bool    fs_remove(FileSystem *fs, size_t inode_number) {
  * @return      Size of specified Inode (-1 if does not exist).
  **/
 ssize_t fs_stat(FileSystem *fs, size_t inode_number) {
-    Inode* in;
-    bool res = fs_load_inode(fs, inode_number, in);
-    if (!res) {
+    Inode in;
+    pthread_rwlock_t *lock = fs_inode_lock(fs, inode_number);
+    if (lock) pthread_rwlock_rdlock(lock);
+    bool loaded = fs_load_inode(fs, inode_number, &in);
+    if (lock) pthread_rwlock_unlock(lock);
+    if (!loaded) {
+        return -1;
+    }
+
+    return in.size;
+}
+
+/**
+ * Return the number of blocks allocated to the specified Inode, including
+ * the indirect pointer block itself.  For sparse files this is smaller than
+ * the block count implied by fs_stat, since holes occupy no blocks.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to examine.
+ * @return      Number of allocated blocks (-1 if Inode does not exist).
+ **/
+ssize_t fs_blocks(FileSystem *fs, size_t inode_number) {
+    Inode in;
+    pthread_rwlock_t *lock = fs_inode_lock(fs, inode_number);
+    if (lock) pthread_rwlock_rdlock(lock);
+    bool loaded = fs_load_inode(fs, inode_number, &in);
+    if (lock) pthread_rwlock_unlock(lock);
+    if (!loaded) {
         return -1;
     }
 
-    int res = in->size;
-    free(in);
-    return res;
+    ssize_t blocks = 0;
+    for (int k = 0; k < POINTERS_PER_INODE; k++) {
+        if (in.direct[k] != 0) {
+            blocks++;
+        }
+    }
+    if (in.indirect == 0) {
+        return blocks;
+    }
+
+    Block indirect;
+    if (disk_read(fs->disk, in.indirect, indirect.data) == DISK_FAILURE) {
+        error("[fs_blocks] error reading indirect block %u\n", in.indirect);
+        return -1;
+    }
+    blocks++;
+    if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+        for (int e = 0; e < EXTENTS_PER_BLOCK && indirect.extents[e].length; e++) {
+            if (indirect.extents[e].start != 0) {
+                blocks += indirect.extents[e].length;
+            }
+        }
+    } else {
+        for (int k = 0; k < POINTERS_PER_BLOCK; k++) {
+            if (indirect.pointers[k] != 0) {
+                blocks++;
+            }
+        }
+    }
+    return blocks;
 }
 
 /**
  * Read from the specified Inode into the data buffer exactly length bytes
  * beginning from the specified offset by doing the following:
  *
- *  1. Load Inode information.
+ *  1. Load Inode information and clamp the request to the file size.
  *
- *  2. Continuously read blocks and copy data to buffer.
+ *  2. Group physically consecutive block pointers into extents and issue one
+ *  vectored read per extent, straight into the caller's buffer for aligned
+ *  full blocks; only the partial blocks at the edges of the request go
+ *  through a staging block.
  *
  *  Note: Data is read from direct blocks first, and then from indirect blocks.
  *
@@ -299,16 +958,116 @@ ssize_t fs_stat(FileSystem *fs, size_t inode_number) {
  * @return      Number of bytes read (-1 on error).
  **/
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
-    Inode* in;
-    bool res = fs_load_inode(fs, inode_number, in);
-    if (!res) {
+    uint64_t start = stats_time();
+    pthread_rwlock_t *lock = fs_inode_lock(fs, inode_number);
+    if (lock) pthread_rwlock_rdlock(lock);
+    ssize_t result = fs_do_read(fs, inode_number, data, length, offset);
+    if (lock) pthread_rwlock_unlock(lock);
+    stats_record(STATS_FS_READ, start);
+    trace_record(STATS_FS_READ, inode_number, offset, length);
+    return result;
+}
+
+ssize_t fs_do_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
+    Inode in;
+    if (!fs_load_inode(fs, inode_number, &in)) {
         return -1;
     }
+    if (offset >= in.size) {
+        return 0;
+    }
+    length = min(length, in.size - offset);
 
-    for (int i = 0; i < POINTERS_PER_INODE; i++) {
-        if (i)
+    Block indirect;
+    bool indirect_loaded = false;
+    size_t copied = 0;
+    while (copied < length) {
+        size_t pos = offset + copied;
+        size_t logical = pos / BLOCK_SIZE;
+        size_t block_offset = pos % BLOCK_SIZE;
+        size_t chunk = min(BLOCK_SIZE - block_offset, length - copied);
+        uint32_t physical = fs_inode_block(fs, &in, &indirect, &indirect_loaded, logical);
+
+        if (physical == 0) {
+            /* Unallocated block reads as zeros */
+            memset(data + copied, 0, chunk);
+            copied += chunk;
+            continue;
+        }
+
+        if (fs->meta_data.compression) {
+            /* Transfer only the compressed bytes and expand on the way out */
+            uint16_t clen = fs->block_lengths[physical];
+            char full[BLOCK_SIZE];
+            char *dest = (block_offset == 0 && chunk == BLOCK_SIZE) ? data + copied : full;
+            if (clen == 0) {
+                if (disk_read(fs->disk, physical, dest) == DISK_FAILURE) {
+                    error("[fs_read] error reading block %u\n", physical);
+                    return -1;
+                }
+            } else {
+                char cbuf[BLOCK_SIZE];
+                if (disk_read_partial(fs->disk, physical, cbuf, clen) == DISK_FAILURE) {
+                    error("[fs_read] error reading block %u\n", physical);
+                    return -1;
+                }
+                if (decompress_block(cbuf, clen, dest, BLOCK_SIZE) != BLOCK_SIZE) {
+                    error("[fs_read] corrupt compressed block %u\n", physical);
+                    return -1;
+                }
+            }
+            if (fs->meta_data.checksums && !fs_checksum_verify(fs, physical, dest)) {
+                return -1;
+            }
+            if (dest == full) {
+                memcpy(data + copied, full + block_offset, chunk);
+            }
+            copied += chunk;
+            continue;
+        }
+
+        if (block_offset != 0 || chunk < BLOCK_SIZE) {
+            char *stage = disk_buffer_alloc(fs->disk);
+            if (stage == NULL) {
+                return -1;
+            }
+            if (disk_read(fs->disk, physical, stage) == DISK_FAILURE) {
+                error("[fs_read] error reading block %u\n", physical);
+                disk_buffer_free(fs->disk, stage);
+                return -1;
+            }
+            if (fs->meta_data.checksums && !fs_checksum_verify(fs, physical, stage)) {
+                disk_buffer_free(fs->disk, stage);
+                return -1;
+            }
+            memcpy(data + copied, stage + block_offset, chunk);
+            disk_buffer_free(fs->disk, stage);
+            copied += chunk;
+            continue;
+        }
+
+        /* Aligned full block: extend over consecutive physical blocks */
+        size_t run = 1;
+        while (copied + (run + 1) * BLOCK_SIZE <= length &&
+               fs_inode_block(fs, &in, &indirect, &indirect_loaded, logical + run) == physical + run) {
+            run++;
+        }
+        if (disk_readv(fs->disk, physical, run, data + copied) == DISK_FAILURE) {
+            error("[fs_read] error reading blocks %u-%zu\n", physical, physical + run - 1);
+            return -1;
+        }
+        if (fs->meta_data.checksums) {
+            for (size_t i = 0; i < run; i++) {
+                if (!fs_checksum_verify(fs, physical + i, data + copied + i * BLOCK_SIZE)) {
+                    return -1;
+                }
+            }
+        }
+        copied += run * BLOCK_SIZE;
     }
-    return -1;
+
+    fs_readahead(fs, inode_number, &in, &indirect, &indirect_loaded, offset, copied);
+    return copied;
 }
 
 /**
@@ -317,40 +1076,388 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
  *
  *  1. Load Inode information.
  *
- *  2. Continuously copy data from buffer to blocks.
+ *  2. Allocate blocks as the write advances, coalescing physically
+ *  consecutive blocks into extents written with one disk_writev each
+ *  (sequential allocation makes fresh blocks consecutive, so a whole copyin
+ *  buffer usually goes out as a single extent).
  *
- *  Note: Data is read from direct blocks first, and then from indirect blocks.
+ *  3. Commit metadata once per call: the indirect pointer block and the
+ *  inode are written at the end of the batch, not once per data block.
+ *
+ *  Note: Data is written to direct blocks first, and then to indirect blocks.
  *
  * @param       fs              Pointer to FileSystem structure.
  * @param       inode_number    Inode to write data to.
  * @param       data            Buffer with data to copy
  * @param       length          Number of bytes to write.
  * @param       offset          Byte offset from which to begin writing.
- * @return      Number of bytes read (-1 on error).
+ * @return      Number of bytes written (-1 on error).
  **/
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
-    return -1;
+    uint64_t start = stats_time();
+    pthread_rwlock_t *lock = fs_inode_lock(fs, inode_number);
+    if (lock) pthread_rwlock_wrlock(lock);
+    ssize_t result = fs_do_write(fs, inode_number, data, length, offset);
+    if (lock) pthread_rwlock_unlock(lock);
+    stats_record(STATS_FS_WRITE, start);
+    trace_record(STATS_FS_WRITE, inode_number, offset, length);
+    return result;
+}
+
+ssize_t fs_do_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
+    Inode in;
+    if (!fs_load_inode(fs, inode_number, &in)) {
+        return -1;
+    }
+    Inode original = in;
+
+    Block indirect;
+    bool indirect_loaded = false;
+    bool indirect_dirty = false;
+    size_t written = 0;
+    size_t map_lo = (size_t)-1;
+    size_t map_hi = 0;
+    size_t ck_lo = (size_t)-1;
+    size_t ck_hi = 0;
+    while (written < length) {
+        size_t pos = offset + written;
+        size_t logical = pos / BLOCK_SIZE;
+        size_t block_offset = pos % BLOCK_SIZE;
+        size_t chunk = min(BLOCK_SIZE - block_offset, length - written);
+        bool fresh = false;
+        uint32_t physical = fs_inode_block(fs, &in, &indirect, &indirect_loaded, logical);
+
+        if (physical == 0) {
+            physical = fs_allocate_block(fs, &in, &indirect, &indirect_loaded, &indirect_dirty, logical);
+            if (physical == 0) {
+                break;
+            }
+            fresh = true;
+        } else if (logical * BLOCK_SIZE >= in.size) {
+            /* Mapped (cluster tail) but never written: nothing to preserve */
+            fresh = true;
+        }
+
+        if (fs->meta_data.compression) {
+            char stage[BLOCK_SIZE];
+            char *src = data + written;
+            if (block_offset != 0 || chunk < BLOCK_SIZE) {
+                uint16_t clen = fs->block_lengths[physical];
+                if (fresh) {
+                    memset(stage, 0, BLOCK_SIZE);
+                } else if (clen == 0) {
+                    if (disk_read(fs->disk, physical, stage) == DISK_FAILURE) {
+                        error("[fs_write] error reading block %u\n", physical);
+                        break;
+                    }
+                } else {
+                    char cbuf[BLOCK_SIZE];
+                    if (disk_read_partial(fs->disk, physical, cbuf, clen) == DISK_FAILURE ||
+                        decompress_block(cbuf, clen, stage, BLOCK_SIZE) != BLOCK_SIZE) {
+                        error("[fs_write] error reading compressed block %u\n", physical);
+                        break;
+                    }
+                }
+                memcpy(stage + block_offset, data + written, chunk);
+                src = stage;
+            }
+
+            char cbuf[BLOCK_SIZE];
+            size_t clen = compress_block(src, BLOCK_SIZE, cbuf, BLOCK_SIZE - 1);
+            if (clen > 0) {
+                if (disk_write_partial(fs->disk, physical, cbuf, clen) == DISK_FAILURE) {
+                    error("[fs_write] error writing block %u\n", physical);
+                    break;
+                }
+            } else if (disk_write(fs->disk, physical, src) == DISK_FAILURE) {
+                error("[fs_write] error writing block %u\n", physical);
+                break;
+            }
+            if (fs->block_lengths[physical] != clen) {
+                fs->block_lengths[physical] = (uint16_t)clen;
+                map_lo = min(map_lo, (size_t)physical);
+                map_hi = physical > map_hi ? physical : map_hi;
+            }
+            if (fs->meta_data.checksums) {
+                fs->block_checksums[physical] = checksum_block(src, BLOCK_SIZE);
+                ck_lo = min(ck_lo, (size_t)physical);
+                ck_hi = physical > ck_hi ? physical : ck_hi;
+            }
+            written += chunk;
+            continue;
+        }
+
+        if (block_offset != 0 || chunk < BLOCK_SIZE) {
+            char *stage = disk_buffer_alloc(fs->disk);
+            if (stage == NULL) {
+                break;
+            }
+            if (fresh) {
+                memset(stage, 0, BLOCK_SIZE);
+            } else if (disk_read(fs->disk, physical, stage) == DISK_FAILURE) {
+                error("[fs_write] error reading block %u\n", physical);
+                disk_buffer_free(fs->disk, stage);
+                break;
+            }
+            memcpy(stage + block_offset, data + written, chunk);
+            if (disk_write(fs->disk, physical, stage) == DISK_FAILURE) {
+                error("[fs_write] error writing block %u\n", physical);
+                disk_buffer_free(fs->disk, stage);
+                break;
+            }
+            if (fs->meta_data.checksums) {
+                fs->block_checksums[physical] = checksum_block(stage, BLOCK_SIZE);
+                ck_lo = min(ck_lo, (size_t)physical);
+                ck_hi = physical > ck_hi ? physical : ck_hi;
+            }
+            disk_buffer_free(fs->disk, stage);
+            written += chunk;
+            continue;
+        }
+
+        /* Aligned full block: extend over consecutive physical blocks */
+        size_t run = 1;
+        while (written + (run + 1) * BLOCK_SIZE <= length) {
+            uint32_t next = fs_inode_block(fs, &in, &indirect, &indirect_loaded, logical + run);
+            if (next == 0) {
+                next = fs_allocate_block(fs, &in, &indirect, &indirect_loaded, &indirect_dirty, logical + run);
+            }
+            if (next != physical + run) {
+                break;
+            }
+            run++;
+        }
+        if (disk_writev(fs->disk, physical, run, data + written) == DISK_FAILURE) {
+            error("[fs_write] error writing blocks %u-%zu\n", physical, physical + run - 1);
+            break;
+        }
+        if (fs->meta_data.checksums) {
+            for (size_t i = 0; i < run; i++) {
+                fs->block_checksums[physical + i] = checksum_block(data + written + i * BLOCK_SIZE, BLOCK_SIZE);
+            }
+            ck_lo = min(ck_lo, (size_t)physical);
+            ck_hi = physical + run - 1 > ck_hi ? physical + run - 1 : ck_hi;
+        }
+        written += run * BLOCK_SIZE;
+    }
+
+    /* Commit batched metadata */
+    if (fs->meta_data.compression && map_lo != (size_t)-1) {
+        size_t base  = 1 + fs->meta_data.inode_blocks + fs->meta_data.bitmap_blocks;
+        size_t first = map_lo * sizeof(uint16_t) / BLOCK_SIZE;
+        size_t last  = map_hi * sizeof(uint16_t) / BLOCK_SIZE;
+        for (size_t m = first; m <= last; m++) {
+            if (disk_write(fs->disk, base + m, (char*)fs->block_lengths + m * BLOCK_SIZE) == DISK_FAILURE) {
+                error("[fs_write] error writing lengths map block %zu\n", base + m);
+                return -1;
+            }
+        }
+    }
+    if (fs->meta_data.checksums && ck_lo != (size_t)-1) {
+        size_t base  = 1 + fs->meta_data.inode_blocks + fs->meta_data.bitmap_blocks +
+                       fs_lengths_blocks(&fs->meta_data);
+        size_t first = ck_lo * sizeof(uint32_t) / BLOCK_SIZE;
+        size_t last  = ck_hi * sizeof(uint32_t) / BLOCK_SIZE;
+        for (size_t m = first; m <= last; m++) {
+            if (disk_write(fs->disk, base + m, (char*)fs->block_checksums + m * BLOCK_SIZE) == DISK_FAILURE) {
+                error("[fs_write] error writing checksum block %zu\n", base + m);
+                return -1;
+            }
+        }
+    }
+    if (indirect_dirty) {
+        if (disk_write(fs->disk, in.indirect, indirect.data) == DISK_FAILURE) {
+            error("[fs_write] error writing indirect block %u\n", in.indirect);
+            return -1;
+        }
+    }
+    if (offset + written > in.size) {
+        in.size = offset + written;
+    }
+    if (memcmp(&original, &in, sizeof(Inode)) != 0 && !fs_save_inode(fs, inode_number, &in)) {
+        return -1;
+    }
+
+    return written;
+}
+
+/**
+ * Submit an asynchronous fs_read on the Disk worker pool; the callback
+ * receives the fs_read return value once it completes.  Multiple submissions
+ * on different inodes run in parallel under the striped inode locks.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to read data from.
+ * @param       data            Buffer to copy data to (must stay valid until completion).
+ * @param       length          Number of bytes to read.
+ * @param       offset          Byte offset from which to begin reading.
+ * @param       callback        Completion callback (may be NULL).
+ * @param       context         Passed to the completion callback.
+ * @return      Whether or not the request was submitted.
+ **/
+bool    fs_read_async(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, FileSystemCallback callback, void *context) {
+    return fs_async_submit(fs, inode_number, data, length, offset, false, callback, context);
+}
+
+/**
+ * Submit an asynchronous fs_write on the Disk worker pool; the callback
+ * receives the fs_write return value once it completes.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to write data to.
+ * @param       data            Buffer with data to copy (must stay valid until completion).
+ * @param       length          Number of bytes to write.
+ * @param       offset          Byte offset from which to begin writing.
+ * @param       callback        Completion callback (may be NULL).
+ * @param       context         Passed to the completion callback.
+ * @return      Whether or not the request was submitted.
+ **/
+bool    fs_write_async(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, FileSystemCallback callback, void *context) {
+    return fs_async_submit(fs, inode_number, data, length, offset, true, callback, context);
+}
+
+/**
+ * Open a handle on the specified Inode by doing the following:
+ *
+ *  1. Resolve and validate the inode number once.
+ *
+ *  2. Claim a slot in the FileSystem handle arena (no per-open allocation)
+ *  and pin the inode: fs_remove refuses pinned inodes until the last handle
+ *  is closed.
+ *
+ * The handle carries its own sequential cursor, so fs_handle_read and
+ * fs_handle_write skip the per-call inode resolution and offset bookkeeping
+ * of the raw inode number API.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to open.
+ * @return      Pointer to pinned FileHandle (NULL if the inode does not
+ *              exist or the arena is full).
+ **/
+FileHandle *fs_open(FileSystem *fs, size_t inode_number) {
+    assert(fs != NULL);
+    Inode in;
+    if (!fs_load_inode(fs, inode_number, &in)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&fs->handle_lock);
+    for (size_t i = 0; i < FS_HANDLE_MAX; i++) {
+        FileHandle *handle = &fs->handles[i];
+        if (handle->fs == fs && handle->inode_number == inode_number) {
+            handle->refs++;
+            pthread_mutex_unlock(&fs->handle_lock);
+            return handle;
+        }
+    }
+    for (size_t i = 0; i < FS_HANDLE_MAX; i++) {
+        FileHandle *handle = &fs->handles[i];
+        if (handle->fs == NULL) {
+            handle->fs           = fs;
+            handle->inode_number = inode_number;
+            handle->refs         = 1;
+            handle->cursor       = 0;
+            pthread_mutex_unlock(&fs->handle_lock);
+            return handle;
+        }
+    }
+    pthread_mutex_unlock(&fs->handle_lock);
+    error("[fs_open] no free handle slots\n");
+    return NULL;
+}
+
+/**
+ * Drop one pin on a handle; the slot is released (and the inode becomes
+ * removable again) when the last pin goes away.
+ *
+ * @param       handle      Pointer to FileHandle structure (NULL is a no-op).
+ **/
+void fs_close(FileHandle *handle) {
+    if (handle == NULL || handle->fs == NULL) {
+        return;
+    }
+    FileSystem *fs = handle->fs;
+    pthread_mutex_lock(&fs->handle_lock);
+    if (--handle->refs == 0) {
+        handle->fs = NULL;
+    }
+    pthread_mutex_unlock(&fs->handle_lock);
+}
+
+/**
+ * Read from the handle's cursor and advance it, so back-to-back calls stream
+ * the file sequentially (which also keeps the readahead window open).
+ *
+ * @param       handle      Pointer to FileHandle structure.
+ * @param       data        Buffer to copy data to.
+ * @param       length      Number of bytes to read.
+ * @return      Number of bytes read (-1 on error).
+ **/
+ssize_t fs_handle_read(FileHandle *handle, char *data, size_t length) {
+    assert(handle != NULL && handle->fs != NULL);
+    ssize_t result = fs_read(handle->fs, handle->inode_number, data, length, handle->cursor);
+    if (result > 0) {
+        handle->cursor += result;
+    }
+    return result;
+}
+
+/**
+ * Write at the handle's cursor and advance it.
+ *
+ * @param       handle      Pointer to FileHandle structure.
+ * @param       data        Buffer with data to copy.
+ * @param       length      Number of bytes to write.
+ * @return      Number of bytes written (-1 on error).
+ **/
+ssize_t fs_handle_write(FileHandle *handle, char *data, size_t length) {
+    assert(handle != NULL && handle->fs != NULL);
+    ssize_t result = fs_write(handle->fs, handle->inode_number, data, length, handle->cursor);
+    if (result > 0) {
+        handle->cursor += result;
+    }
+    return result;
+}
+
+/**
+ * Reposition the handle's cursor.
+ *
+ * @param       handle      Pointer to FileHandle structure.
+ * @param       offset      New cursor position in bytes.
+ * @return      Whether or not the handle is valid.
+ **/
+bool fs_handle_seek(FileHandle *handle, size_t offset) {
+    if (handle == NULL || handle->fs == NULL) {
+        return false;
+    }
+    handle->cursor = offset;
+    return true;
+}
+
+/**
+ * Logical size of the file behind the handle.
+ *
+ * @param       handle      Pointer to FileHandle structure.
+ * @return      Size of the pinned inode in bytes (-1 on error).
+ **/
+ssize_t fs_handle_stat(FileHandle *handle) {
+    assert(handle != NULL && handle->fs != NULL);
+    return fs_stat(handle->fs, handle->inode_number);
 }
 
 bool fs_load_inode(FileSystem *fs, size_t inode_number, Inode *node) {
     assert(fs != NULL);
     assert(fs->disk != NULL);
-    assert(node == NULL);
-
-    size_t blk_number = inode_number / INODES_PER_BLOCK;
-    size_t offset = inode_number - (INODES_PER_BLOCK * blk_number);
-    Block blk;
-    if (disk_read(fs->disk, blk_number, blk.data) == DISK_FAILURE) {
-        error("[fs_load_inode] error reading block from disk\n");
+    assert(node != NULL);
+    if (inode_number >= fs->meta_data.inodes) {
         return false;
     }
 
-    Inode in = blk.inodes[offset];
-    if (!in.valid) {
+    Inode *in = &fs->inode_table[inode_number / INODES_PER_BLOCK].inodes[inode_number % INODES_PER_BLOCK];
+    if (!in->valid) {
         return false;
     }
-    node = malloc(sizeof(Inode));
-    memcpy(node, &in, sizeof(Inode));
+    *node = *in;
     return true;
 }
 
@@ -358,52 +1465,973 @@ bool fs_save_inode(FileSystem *fs, size_t inode_number, Inode *node) {
     assert(fs != NULL);
     assert(fs->disk != NULL);
     assert(node != NULL);
-    size_t blk_number = inode_number / INODES_PER_BLOCK;
-    size_t offset = inode_number - (INODES_PER_BLOCK * blk_number);
-
-    Block blk;
-    if (disk_read(fs->disk, blk_number, blk.data) == DISK_FAILURE) {
-        error("[fs_save_inode] error reading block from disk\n");
+    if (inode_number >= fs->meta_data.inodes) {
         return false;
     }
 
-    blk.inodes[offset] = *node;
-    if (disk_write(fs->disk, blk_number, blk.data) == DISK_FAILURE) {
+    size_t table_block = inode_number / INODES_PER_BLOCK;
+    pthread_mutex_lock(&fs->itable_lock);
+    fs->inode_table[table_block].inodes[inode_number % INODES_PER_BLOCK] = *node;
+    if (fs->journal_ready) {
+        /* One sequential journal record instead of the scattered home write;
+         * the table block reaches its home location at the next checkpoint.
+         * The append commits the pending journal block, so success here
+         * means the record is on disk, not just in process memory */
+        pthread_mutex_unlock(&fs->itable_lock);
+        return fs_journal_append(fs, JOURNAL_ENTRY_INODE, inode_number, node);
+    }
+    if (disk_write(fs->disk, 1 + table_block, fs->inode_table[table_block].data) == DISK_FAILURE) {
         error("[fs_save_inode] error writing block to disk\n");
+        pthread_mutex_unlock(&fs->itable_lock);
         return false;
     }
+    pthread_mutex_unlock(&fs->itable_lock);
 
     return true;
 }
 
-void fs_initialize_free_block_bitmap(FileSystem *fs) {
+/**
+ * Build the free block bitmap by doing the following:
+ *
+ *  1. Allocate one packed bitmap word per 64 blocks with all blocks marked
+ *  in use.
+ *
+ *  2. Release every block past the inode table and bitmap region.
+ *
+ *  3. Walk the inode table and reserve every block referenced by a valid
+ *  inode (direct pointers, indirect pointer block, indirect data pointers).
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the bitmap was built successfully.
+ **/
+bool fs_initialize_free_block_bitmap(FileSystem *fs) {
     assert(fs != NULL);
     assert(fs->disk != NULL);
 
-    uint32_t data_blocks = fs->meta_data.blocks - fs->meta_data.inode_blocks;
-    bool* free_blocks = (bool*)malloc(sizeof(bool) * data_blocks);
-    memset(free_blocks, 0, sizeof(bool) * data_blocks);
-    for (int i = 1; i <= fs->meta_data.inode_blocks; i++) {
-        Block blk;
-        if (disk_read(fs->disk, i, blk.data) == DISK_FAILURE) {
-            error("[fs_initialize_free_block_bitmap] error reading inode blocks\n");
-            return;
-        }
-    
+    size_t words = (fs->meta_data.blocks + 63) / 64;
+    if (fs->meta_data.bitmap_blocks > 0) {
+        words = (size_t)fs->meta_data.bitmap_blocks * BLOCK_SIZE / sizeof(uint64_t);
+    }
+    uint64_t* free_blocks = (uint64_t*)calloc(words, sizeof(uint64_t));
+    if (free_blocks == NULL) {
+        return false;
+    }
+    fs->free_blocks = free_blocks;
+    fs->free_block_count = 0;
+    memset(fs->group_free, 0, fs->group_count * sizeof(size_t));
+
+    for (size_t b = 1 + fs->meta_data.inode_blocks + fs->meta_data.bitmap_blocks +
+         fs_lengths_blocks(&fs->meta_data) + fs_checksum_blocks(&fs->meta_data) +
+         fs->meta_data.journal_blocks;
+         b < fs->meta_data.blocks; b++) {
+        fs_bitmap_release(fs, b);
+    }
+
+    for (uint32_t i = 1; i <= fs->meta_data.inode_blocks; i++) {
+        Block *blk = &fs->inode_table[i - 1];
+
         for (int j = 0; j < INODES_PER_BLOCK; j++) {
-            Inode in = blk.inodes[j];
+            Inode in = blk->inodes[j];
             if (!in.valid) continue;
 
             for (int ptr = 0; ptr < POINTERS_PER_INODE; ptr++) {
                 if (in.direct[ptr] != 0) {
-                    int idx = in.direct[ptr] - 1 - fs->meta_data.inode_blocks;
-                    free_blocks[idx] = true;
+                    fs_bitmap_reserve(fs, in.direct[ptr]);
+                }
+            }
+
+            if (in.indirect != 0) {
+                fs_bitmap_reserve(fs, in.indirect);
+                Block indirect;
+                if (disk_read(fs->disk, in.indirect, indirect.data) == DISK_FAILURE) {
+                    error("[fs_initialize_free_block_bitmap] error reading indirect block\n");
+                    free(fs->free_blocks);
+                    fs->free_blocks = NULL;
+                    return false;
+                }
+                if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+                    for (int e = 0; e < EXTENTS_PER_BLOCK && indirect.extents[e].length; e++) {
+                        if (indirect.extents[e].start == 0) continue;  /* hole */
+                        for (uint32_t b = 0; b < indirect.extents[e].length; b++) {
+                            fs_bitmap_reserve(fs, indirect.extents[e].start + b);
+                        }
+                    }
+                } else {
+                    for (int ptr = 0; ptr < POINTERS_PER_BLOCK; ptr++) {
+                        if (indirect.pointers[ptr] != 0) {
+                            fs_bitmap_reserve(fs, indirect.pointers[ptr]);
+                        }
+                    }
                 }
             }
         }
     }
 
-    fs->free_blocks = free_blocks;
+    return true;
+}
+
+/**
+ * Report whether the specified block is free.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       block   Block number to check.
+ * @return      Whether or not the block is marked free in the bitmap.
+ **/
+bool fs_block_is_free(FileSystem *fs, size_t block) {
+    assert(fs != NULL);
+    if (fs->free_blocks == NULL || block >= fs->meta_data.blocks) {
+        return false;
+    }
+    return fs->free_blocks[block / 64] & (1ULL << (block % 64));
+}
+
+/* Internal Functions */
+
+/**
+ * Translate a logical block index within an Inode to its physical block
+ * number, loading the indirect pointer block on first use (the caller keeps
+ * it across calls so one fs_read/fs_write pays at most one indirect read).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       node            Pointer to Inode structure.
+ * @param       indirect        Caller-provided indirect block buffer.
+ * @param       indirect_loaded Whether the buffer holds the indirect block.
+ * @param       logical         Logical block index within the Inode.
+ * @return      Physical block number (0 if unallocated or out of range).
+ **/
+uint32_t fs_inode_block(FileSystem *fs, Inode *node, Block *indirect, bool *indirect_loaded, size_t logical) {
+    bool v2 = fs->meta_data.magic_number == MAGIC_NUMBER_V2;
+    if (logical < POINTERS_PER_INODE) {
+        return node->direct[logical];
+    }
+    if (node->indirect == 0 || (!v2 && logical >= POINTERS_PER_INODE + POINTERS_PER_BLOCK)) {
+        return 0;
+    }
+
+    if (!*indirect_loaded) {
+        if (disk_read(fs->disk, node->indirect, indirect->data) == DISK_FAILURE) {
+            error("[fs_inode_block] error reading indirect block %u\n", node->indirect);
+            return 0;
+        }
+        *indirect_loaded = true;
+    }
+    if (!v2) {
+        return indirect->pointers[logical - POINTERS_PER_INODE];
+    }
+
+    /* v2: extents map consecutive logical blocks, densely packed from the front */
+    size_t remaining = logical - POINTERS_PER_INODE;
+    for (int e = 0; e < EXTENTS_PER_BLOCK && indirect->extents[e].length; e++) {
+        if (remaining < indirect->extents[e].length) {
+            /* Records with start 0 are holes and read back as zeros */
+            return indirect->extents[e].start ? indirect->extents[e].start + remaining : 0;
+        }
+        remaining -= indirect->extents[e].length;
+    }
+    return 0;
+}
+
+/**
+ * Bind a new physical block to the specified logical block index by doing
+ * the following:
+ *
+ *  1. Allocate (and zero) the indirect pointer block first if the index
+ *  falls past the direct pointers and no indirect block exists yet.
+ *
+ *  2. Reserve the lowest free block in the bitmap and record it in the
+ *  direct pointers or the in-memory indirect block.
+ *
+ * The caller is responsible for writing the dirtied indirect block and the
+ * updated Inode back once per batch.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       node            Pointer to Inode structure.
+ * @param       indirect        Caller-provided indirect block buffer.
+ * @param       indirect_loaded Whether the buffer holds the indirect block.
+ * @param       indirect_dirty  Set when the indirect block must be written.
+ * @param       logical         Logical block index within the Inode.
+ * @return      Newly allocated physical block number (0 on failure).
+ **/
+uint32_t fs_allocate_block(FileSystem *fs, Inode *node, Block *indirect, bool *indirect_loaded, bool *indirect_dirty, size_t logical) {
+    bool v2 = fs->meta_data.magic_number == MAGIC_NUMBER_V2;
+    if (!v2 && logical >= POINTERS_PER_INODE + POINTERS_PER_BLOCK) {
+        return 0;
+    }
+
+    size_t hint = fs_allocation_hint(fs, node, indirect, *indirect_loaded);
+
+    if (logical >= POINTERS_PER_INODE) {
+        if (node->indirect == 0) {
+            ssize_t pointer_block = fs_bitmap_acquire(fs, hint);
+            if (pointer_block < 0) {
+                return 0;
+            }
+            node->indirect = pointer_block;
+            hint = pointer_block;
+            memset(indirect->data, 0, BLOCK_SIZE);
+            *indirect_loaded = true;
+            *indirect_dirty = true;
+        } else if (!*indirect_loaded) {
+            if (disk_read(fs->disk, node->indirect, indirect->data) == DISK_FAILURE) {
+                error("[fs_allocate_block] error reading indirect block %u\n", node->indirect);
+                return 0;
+            }
+            *indirect_loaded = true;
+        }
+    }
+
+    if (logical < POINTERS_PER_INODE || !v2) {
+        ssize_t block = fs_bitmap_acquire(fs, hint);
+        if (block < 0) {
+            return 0;
+        }
+        if (logical < POINTERS_PER_INODE) {
+            node->direct[logical] = block;
+        } else {
+            indirect->pointers[logical - POINTERS_PER_INODE] = block;
+            *indirect_dirty = true;
+        }
+        return block;
+    }
+
+    /* v2: extents map consecutive logical blocks; gaps are recorded as hole
+     * extents (start 0) so a write past the end allocates nothing for the
+     * skipped range */
+    size_t mapped = fs_extent_blocks(indirect);
+    size_t target = logical - POINTERS_PER_INODE;
+    if (target < mapped) {
+        uint32_t block = fs_extent_fill(fs, indirect, target);
+        if (block != 0) {
+            *indirect_dirty = true;
+        }
+        return block;
+    }
+
+    if (target > mapped) {
+        if (!fs_extent_append_hole(indirect, target - mapped)) {
+            return 0;
+        }
+        *indirect_dirty = true;
+    }
+
+    /* Claim a whole cluster when the image was formatted with one.  The tail
+     * of the run is zeroed before it is mapped: once a block is in the extent
+     * block, fs_do_read returns its raw contents below the file size, so an
+     * unwritten mapped block must never expose a previous owner's data */
+    if (fs->cluster_blocks > 1) {
+        ssize_t run = fs_bitmap_acquire_cluster(fs, hint);
+        if (run >= 0) {
+            char *zeros = calloc(fs->cluster_blocks - 1, BLOCK_SIZE);
+            if (zeros == NULL ||
+                disk_writev(fs->disk, run + 1, fs->cluster_blocks - 1, zeros) == DISK_FAILURE) {
+                free(zeros);
+                for (size_t j = 0; j < fs->cluster_blocks; j++) {
+                    fs_bitmap_release(fs, run + j);
+                }
+                return 0;
+            }
+            free(zeros);
+            for (size_t i = 0; i < fs->cluster_blocks; i++) {
+                if (!fs_extent_append(indirect, run + i)) {
+                    for (size_t j = i; j < fs->cluster_blocks; j++) {
+                        fs_bitmap_release(fs, run + j);
+                    }
+                    if (i == 0) {
+                        /* Nothing of the run was mapped: returning run here
+                         * would hand the caller a block that is marked free */
+                        return 0;
+                    }
+                    break;
+                }
+            }
+            *indirect_dirty = true;
+            return run;
+        }
+    }
+
+    ssize_t b = fs_bitmap_acquire(fs, hint);
+    if (b < 0) {
+        return 0;
+    }
+    if (!fs_extent_append(indirect, b)) {
+        fs_bitmap_release(fs, b);
+        return 0;
+    }
+    *indirect_dirty = true;
+    return b;
+}
+
+/**
+ * Detect sequential access and prefetch ahead of it by doing the following:
+ *
+ *  1. Compare this fs_read against the recorded end of the previous one; a
+ *  match on inode and offset means a sequential consumer.
+ *
+ *  2. Translate the next ra_window logical blocks (clamped to the file size)
+ *  and hand physically consecutive runs to disk_prefetch, which pulls them
+ *  into the block cache in the background.
+ *
+ * Translation only uses pointers already in memory (direct pointers or the
+ * indirect block the read just loaded), so readahead never adds disk I/O of
+ * its own on the foreground path.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode that was read.
+ * @param       node            Pointer to Inode structure.
+ * @param       indirect        Indirect block buffer from the read.
+ * @param       indirect_loaded Whether the buffer holds the indirect block.
+ * @param       offset          Byte offset of the read.
+ * @param       length          Bytes actually read.
+ **/
+void fs_readahead(FileSystem *fs, size_t inode_number, Inode *node, Block *indirect, bool *indirect_loaded, size_t offset, size_t length) {
+    pthread_mutex_lock(&fs->ra_lock);
+    bool sequential = fs->ra_inode == inode_number && fs->ra_offset == offset;
+    fs->ra_inode  = inode_number;
+    fs->ra_offset = offset + length;
+    size_t window = fs->ra_window;
+    pthread_mutex_unlock(&fs->ra_lock);
+
+    if (!sequential || window == 0 || length == 0) {
+        return;
+    }
+
+    size_t next = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t last = (node->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t end  = min(next + window, last);
+
+    uint32_t run_start = 0;
+    size_t   run_len   = 0;
+    for (size_t logical = next; logical < end; logical++) {
+        if (logical >= POINTERS_PER_INODE && !*indirect_loaded) {
+            break;
+        }
+        uint32_t physical = fs_inode_block(fs, node, indirect, indirect_loaded, logical);
+        if (physical != 0 && run_len > 0 && physical == run_start + run_len) {
+            run_len++;
+            continue;
+        }
+        if (run_len > 0) {
+            disk_prefetch(fs->disk, run_start, run_len);
+            run_len = 0;
+        }
+        if (physical != 0) {
+            run_start = physical;
+            run_len   = 1;
+        }
+    }
+    if (run_len > 0) {
+        disk_prefetch(fs->disk, run_start, run_len);
+    }
+}
+
+/**
+ * Count the logical blocks mapped by an extent block.
+ *
+ * @param       indirect    Pointer to extent Block.
+ * @return      Total length of all extent records.
+ **/
+size_t fs_extent_blocks(Block *indirect) {
+    size_t total = 0;
+    for (int e = 0; e < EXTENTS_PER_BLOCK && indirect->extents[e].length; e++) {
+        total += indirect->extents[e].length;
+    }
+    return total;
+}
+
+/**
+ * Append one physical block to an extent block, growing the last extent when
+ * the block is physically consecutive and starting a new record otherwise.
+ *
+ * @param       indirect    Pointer to extent Block.
+ * @param       block       Physical block number to append.
+ * @return      Whether or not the block was recorded (false when all extent
+ *              records are in use).
+ **/
+bool fs_extent_append(Block *indirect, uint32_t block) {
+    int e = 0;
+    while (e < EXTENTS_PER_BLOCK && indirect->extents[e].length) {
+        e++;
+    }
+    if (e > 0 && indirect->extents[e - 1].start != 0 &&
+        indirect->extents[e - 1].start + indirect->extents[e - 1].length == block) {
+        indirect->extents[e - 1].length++;
+        return true;
+    }
+    if (e == EXTENTS_PER_BLOCK) {
+        return false;
+    }
+    indirect->extents[e].start  = block;
+    indirect->extents[e].length = 1;
+    return true;
+}
+
+/**
+ * Record a run of unallocated logical blocks in an extent block, growing the
+ * last record when it is already a hole and starting a new one otherwise.
+ *
+ * @param       indirect    Pointer to extent Block.
+ * @param       length      Number of logical blocks the hole covers.
+ * @return      Whether or not the hole was recorded (false when all extent
+ *              records are in use).
+ **/
+bool fs_extent_append_hole(Block *indirect, uint32_t length) {
+    int e = 0;
+    while (e < EXTENTS_PER_BLOCK && indirect->extents[e].length) {
+        e++;
+    }
+    if (e > 0 && indirect->extents[e - 1].start == 0) {
+        indirect->extents[e - 1].length += length;
+        return true;
+    }
+    if (e == EXTENTS_PER_BLOCK) {
+        return false;
+    }
+    indirect->extents[e].start  = 0;
+    indirect->extents[e].length = length;
+    return true;
+}
+
+/**
+ * Bind a fresh physical block to a logical index that falls inside a hole
+ * extent by splitting the hole into up to three records (leading hole, the
+ * new single-block extent, trailing hole).
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       indirect    Pointer to extent Block.
+ * @param       target      Logical index relative to the indirect region.
+ * @return      Newly allocated physical block number (0 on failure).
+ **/
+uint32_t fs_extent_fill(FileSystem *fs, Block *indirect, size_t target) {
+    int used = 0;
+    while (used < EXTENTS_PER_BLOCK && indirect->extents[used].length) {
+        used++;
+    }
+
+    size_t remaining = target;
+    for (int e = 0; e < used; e++) {
+        if (remaining >= indirect->extents[e].length) {
+            remaining -= indirect->extents[e].length;
+            continue;
+        }
+        if (indirect->extents[e].start != 0) {
+            error("[fs_extent_fill] logical index %zu is already mapped\n", target);
+            return 0;
+        }
+
+        uint32_t before = remaining;
+        uint32_t after  = indirect->extents[e].length - remaining - 1;
+        int      extra  = (before > 0) + (after > 0);
+        if (used + extra > EXTENTS_PER_BLOCK) {
+            return 0;
+        }
+        size_t hint = 0;
+        for (int p = 0; p < e; p++) {
+            if (indirect->extents[p].start != 0) {
+                hint = indirect->extents[p].start + indirect->extents[p].length - 1;
+            }
+        }
+        ssize_t block = fs_bitmap_acquire(fs, hint);
+        if (block < 0) {
+            return 0;
+        }
+
+        memmove(&indirect->extents[e + 1 + extra], &indirect->extents[e + 1],
+                (used - e - 1) * sizeof(Extent));
+        if (before > 0) {
+            indirect->extents[e].length = before;
+            e++;
+        }
+        indirect->extents[e].start  = block;
+        indirect->extents[e].length = 1;
+        if (after > 0) {
+            indirect->extents[e + 1].start  = 0;
+            indirect->extents[e + 1].length = after;
+        }
+        return block;
+    }
+    return 0;
+}
+
+/**
+ * Mark the specified block as in use, updating the free count.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       block   Block number to reserve.
+ **/
+void fs_bitmap_reserve(FileSystem *fs, size_t block) {
+    uint64_t mask  = 1ULL << (block % 64);
+    size_t   group = block / fs->group_blocks;
+    pthread_mutex_t *lock = &fs->group_locks[group % FS_GROUP_LOCKS];
+    pthread_mutex_lock(lock);
+    if (fs->free_blocks[block / 64] & mask) {
+        fs->free_blocks[block / 64] &= ~mask;
+        fs->group_free[group]--;
+        __atomic_fetch_sub(&fs->free_block_count, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * Mark the specified block as free, updating the free count.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       block   Block number to release.
+ **/
+void fs_bitmap_release(FileSystem *fs, size_t block) {
+    uint64_t mask  = 1ULL << (block % 64);
+    size_t   group = block / fs->group_blocks;
+    pthread_mutex_t *lock = &fs->group_locks[group % FS_GROUP_LOCKS];
+    pthread_mutex_lock(lock);
+    if (!(fs->free_blocks[block / 64] & mask)) {
+        fs->free_blocks[block / 64] |= mask;
+        fs->group_free[group]++;
+        __atomic_fetch_add(&fs->free_block_count, 1, __ATOMIC_RELAXED);
+        fs_journal_append(fs, JOURNAL_ENTRY_FREE, block, NULL);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * Find the lowest numbered free block within one allocation group by
+ * scanning its bitmap words and using the count of trailing zeros to locate
+ * the first set bit.  Caller must hold the group lock.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       group   Allocation group to scan.
+ * @return      Lowest free block number in the group (-1 if none are free).
+ **/
+ssize_t fs_group_find_free(FileSystem *fs, size_t group) {
+    if (fs->group_free[group] == 0) {
+        return -1;
+    }
+
+    size_t words = (fs->meta_data.blocks + 63) / 64;
+    size_t first = (group * fs->group_blocks) / 64;
+    size_t last  = min(((group + 1) * fs->group_blocks + 63) / 64, words);
+    for (size_t w = first; w < last; w++) {
+        if (fs->free_blocks[w] == 0) continue;
+
+        return w * 64 + __builtin_ctzll(fs->free_blocks[w]);
+    }
+    return -1;
+}
+
+/**
+ * Package an asynchronous read or write request and hand it to the Disk
+ * worker pool (FileSystemCallback and DiskAsyncCallback share a signature,
+ * so the callback passes through unchanged).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to operate on.
+ * @param       data            Caller's data buffer.
+ * @param       length          Number of bytes to transfer.
+ * @param       offset          Byte offset of the transfer.
+ * @param       write           Whether to write instead of read.
+ * @param       callback        Completion callback (may be NULL).
+ * @param       context         Passed to the completion callback.
+ * @return      Whether or not the request was submitted.
+ **/
+bool fs_async_submit(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset, bool write, FileSystemCallback callback, void *context) {
+    assert(fs != NULL);
+    if (fs->disk == NULL) {
+        return false;
+    }
+
+    FileSystemAsyncOp *op = (FileSystemAsyncOp*)malloc(sizeof(FileSystemAsyncOp));
+    if (op == NULL) {
+        return false;
+    }
+    op->fs           = fs;
+    op->inode_number = inode_number;
+    op->data         = data;
+    op->length       = length;
+    op->offset       = offset;
+    return disk_async_submit(fs->disk, write ? fs_async_write_work : fs_async_read_work, op, (DiskAsyncCallback)callback, context);
+}
+
+ssize_t fs_async_read_work(void *work_context) {
+    FileSystemAsyncOp *op = (FileSystemAsyncOp*)work_context;
+    ssize_t result = fs_read(op->fs, op->inode_number, op->data, op->length, op->offset);
+    free(op);
+    return result;
+}
+
+ssize_t fs_async_write_work(void *work_context) {
+    FileSystemAsyncOp *op = (FileSystemAsyncOp*)work_context;
+    ssize_t result = fs_write(op->fs, op->inode_number, op->data, op->length, op->offset);
+    free(op);
+    return result;
+}
+
+/**
+ * Atomically find, reserve, and return a free block, preferring the
+ * allocation group holding the hint block so a file grows near the blocks
+ * it already has (the find and the reserve happen under one group lock hold
+ * so two writers can never claim the same block, and writers in different
+ * groups proceed in parallel).
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       hint    Block number to allocate near (0 for no preference).
+ * @return      Reserved block number (-1 if no blocks are free).
+ **/
+ssize_t fs_bitmap_acquire(FileSystem *fs, size_t hint) {
+    if (hint >= fs->meta_data.blocks) {
+        hint = 0;
+    }
+    size_t start = hint / fs->group_blocks;
+    for (size_t i = 0; i < fs->group_count; i++) {
+        size_t group = (start + i) % fs->group_count;
+        if (fs->group_free[group] == 0) {
+            continue;   /* unlocked peek; full pass below catches races */
+        }
+        pthread_mutex_t *lock = &fs->group_locks[group % FS_GROUP_LOCKS];
+        pthread_mutex_lock(lock);
+        ssize_t block = fs_group_find_free(fs, group);
+        if (block >= 0) {
+            fs->free_blocks[block / 64] &= ~(1ULL << (block % 64));
+            fs->group_free[group]--;
+            __atomic_fetch_sub(&fs->free_block_count, 1, __ATOMIC_RELAXED);
+            fs_journal_append(fs, JOURNAL_ENTRY_ALLOC, block, NULL);
+            pthread_mutex_unlock(lock);
+            return block;
+        }
+        pthread_mutex_unlock(lock);
+    }
+
+    for (size_t group = 0; group < fs->group_count; group++) {
+        pthread_mutex_t *lock = &fs->group_locks[group % FS_GROUP_LOCKS];
+        pthread_mutex_lock(lock);
+        ssize_t block = fs_group_find_free(fs, group);
+        if (block >= 0) {
+            fs->free_blocks[block / 64] &= ~(1ULL << (block % 64));
+            fs->group_free[group]--;
+            __atomic_fetch_sub(&fs->free_block_count, 1, __ATOMIC_RELAXED);
+            fs_journal_append(fs, JOURNAL_ENTRY_ALLOC, block, NULL);
+            pthread_mutex_unlock(lock);
+            return block;
+        }
+        pthread_mutex_unlock(lock);
+    }
+    return -1;
+}
+
+/**
+ * Atomically find and reserve an aligned run of cluster_blocks consecutive
+ * free blocks, preferring the allocation group holding the hint block.  Runs
+ * never straddle a group boundary.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       hint    Block number to allocate near (0 for no preference).
+ * @return      First block of the reserved run (-1 if no aligned run is free).
+ **/
+ssize_t fs_bitmap_acquire_cluster(FileSystem *fs, size_t hint) {
+    size_t n = fs->cluster_blocks;
+    if (hint >= fs->meta_data.blocks) {
+        hint = 0;
+    }
+    size_t start = hint / fs->group_blocks;
+    for (size_t i = 0; i < fs->group_count; i++) {
+        size_t group = (start + i) % fs->group_count;
+        if (fs->group_free[group] < n) {
+            continue;
+        }
+        pthread_mutex_t *lock = &fs->group_locks[group % FS_GROUP_LOCKS];
+        pthread_mutex_lock(lock);
+        size_t first = group * fs->group_blocks;
+        size_t last  = min((group + 1) * fs->group_blocks, (size_t)fs->meta_data.blocks);
+        first = (first + n - 1) / n * n;
+        for (size_t run = first; run + n <= last; run += n) {
+            size_t b = 0;
+            while (b < n && (fs->free_blocks[(run + b) / 64] & (1ULL << ((run + b) % 64)))) {
+                b++;
+            }
+            if (b < n) {
+                continue;
+            }
+            for (b = 0; b < n; b++) {
+                fs->free_blocks[(run + b) / 64] &= ~(1ULL << ((run + b) % 64));
+            }
+            fs->group_free[group] -= n;
+            __atomic_fetch_sub(&fs->free_block_count, n, __ATOMIC_RELAXED);
+            for (b = 0; b < n; b++) {
+                fs_journal_append(fs, JOURNAL_ENTRY_ALLOC, run + b, NULL);
+            }
+            pthread_mutex_unlock(lock);
+            return run;
+        }
+        pthread_mutex_unlock(lock);
+    }
+    return -1;
+}
+
+/**
+ * Pick the block a new allocation should land near: the last block the
+ * Inode already owns, so files stay within their allocation group and the
+ * extent-coalescing read path keeps finding long runs.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       node            Pointer to Inode structure.
+ * @param       indirect        Caller-provided indirect block buffer.
+ * @param       indirect_loaded Whether the buffer holds the indirect block.
+ * @return      Hint block number (0 for no preference).
+ **/
+size_t fs_allocation_hint(FileSystem *fs, Inode *node, Block *indirect, bool indirect_loaded) {
+    if (fs->meta_data.magic_number == MAGIC_NUMBER_V2 && indirect_loaded) {
+        size_t hint = 0;
+        for (int e = 0; e < EXTENTS_PER_BLOCK && indirect->extents[e].length; e++) {
+            if (indirect->extents[e].start != 0) {
+                hint = indirect->extents[e].start + indirect->extents[e].length - 1;
+            }
+        }
+        if (hint != 0) {
+            return hint;
+        }
+    }
+    if (node->indirect != 0) {
+        return node->indirect;
+    }
+    for (int k = POINTERS_PER_INODE - 1; k >= 0; k--) {
+        if (node->direct[k] != 0) {
+            return node->direct[k];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Map an inode number to its lock stripe.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode number to map.
+ * @return      Pointer to stripe lock (NULL if not mounted).
+ **/
+pthread_rwlock_t *fs_inode_lock(FileSystem *fs, size_t inode_number) {
+    if (fs == NULL || fs->disk == NULL) {
+        return NULL;
+    }
+    return &fs->inode_locks[inode_number % FS_LOCK_STRIPES];
+}
+
+/**
+ * Load the persisted free block bitmap from its on-disk region with one
+ * vectored read, then recover the free count with a population count over
+ * the bitmap words.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the bitmap was loaded successfully.
+ **/
+bool fs_load_free_block_bitmap(FileSystem *fs) {
+    uint64_t *bitmap = (uint64_t*)malloc((size_t)fs->meta_data.bitmap_blocks * BLOCK_SIZE);
+    if (bitmap == NULL) {
+        return false;
+    }
+    if (disk_readv(fs->disk, 1 + fs->meta_data.inode_blocks, fs->meta_data.bitmap_blocks, (char*)bitmap) == DISK_FAILURE) {
+        error("[fs_load_free_block_bitmap] error reading bitmap region\n");
+        free(bitmap);
+        return false;
+    }
+
+    fs->free_blocks = bitmap;
+    fs->free_block_count = 0;
+    for (size_t w = 0; w < (fs->meta_data.blocks + 63) / 64; w++) {
+        size_t free = __builtin_popcountll(fs->free_blocks[w]);
+        fs->free_block_count += free;
+        fs->group_free[(w * 64) / fs->group_blocks] += free;
+    }
+    return true;
+}
+
+/**
+ * Write the in-memory free block bitmap back to its on-disk region with one
+ * vectored write (the region tail past the bitmap words stays zeroed).
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the bitmap was stored successfully.
+ **/
+bool fs_store_free_block_bitmap(FileSystem *fs) {
+    char *region = calloc(fs->meta_data.bitmap_blocks, BLOCK_SIZE);
+    if (region == NULL) {
+        return false;
+    }
+    memcpy(region, fs->free_blocks, (fs->meta_data.blocks + 63) / 64 * sizeof(uint64_t));
+    if (disk_writev(fs->disk, 1 + fs->meta_data.inode_blocks, fs->meta_data.bitmap_blocks, region) == DISK_FAILURE) {
+        error("[fs_store_free_block_bitmap] error writing bitmap region\n");
+        free(region);
+        return false;
+    }
+    free(region);
+    return true;
+}
+
+/**
+ * Write the FileSystem meta data back to the SuperBlock on Disk.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the SuperBlock was written successfully.
+ **/
+bool fs_write_superblock(FileSystem *fs) {
+    Block blk;
+    memset(blk.data, 0, BLOCK_SIZE);
+    blk.super = fs->meta_data;
+    if (disk_write(fs->disk, 0, blk.data) == DISK_FAILURE) {
+        error("[fs_write_superblock] error writing super block\n");
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * First block of the metadata journal region.
+ **/
+size_t fs_journal_base(SuperBlock *sb) {
+    return 1 + sb->inode_blocks + sb->bitmap_blocks + fs_lengths_blocks(sb) + fs_checksum_blocks(sb);
+}
+
+/**
+ * Append a metadata record to the journal.  Records from concurrent
+ * operations accumulate in a shared in-memory journal block (group commit)
+ * that goes to disk with one sequential write at every commit point: an
+ * INODE record (the closing record of each operation, so its preceding
+ * ALLOC/FREE records ride along) or a full block.  Filling the whole region
+ * triggers a checkpoint back to the home locations.  Records are dropped
+ * silently before the mount finishes (the scan and replay paths rebuild
+ * that state themselves).
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       type        JOURNAL_ENTRY_* record type.
+ * @param       number      Inode or block number.
+ * @param       node        New inode contents (JOURNAL_ENTRY_INODE only).
+ *
+ * @return      Whether or not the record reached the journal (interior
+ *              ALLOC/FREE records report true until their commit point).
+ **/
+bool fs_journal_append(FileSystem *fs, uint32_t type, uint32_t number, Inode *node) {
+    if (!fs->journal_ready) {
+        return true;
+    }
+    pthread_mutex_lock(&fs->journal_lock);
+    JournalBlock *journal = (JournalBlock*)fs->journal_buffer.data;
+    JournalEntry *entry   = &journal->entries[journal->count++];
+    entry->type   = type;
+    entry->number = number;
+    if (node != NULL) {
+        entry->inode = *node;
+    } else {
+        memset(&entry->inode, 0, sizeof(Inode));
+    }
+    bool committed = true;
+    if (type == JOURNAL_ENTRY_INODE || journal->count == JOURNAL_ENTRIES) {
+        committed = fs_journal_flush_locked(fs);
+    }
+    pthread_mutex_unlock(&fs->journal_lock);
+    return committed;
+}
+
+/**
+ * Write the pending journal block to the journal region (journal lock held).
+ * Filling the last slot checkpoints and rewinds the journal.
+ **/
+bool fs_journal_flush_locked(FileSystem *fs) {
+    JournalBlock *journal = (JournalBlock*)fs->journal_buffer.data;
+    if (journal->count == 0) {
+        return true;
+    }
+    journal->magic    = JOURNAL_MAGIC;
+    journal->sequence = fs->journal_sequence;
+    journal->checksum = checksum_block((char*)journal->entries, sizeof(journal->entries));
+    if (disk_write(fs->disk, fs_journal_base(&fs->meta_data) + fs->journal_head,
+                   fs->journal_buffer.data) == DISK_FAILURE) {
+        error("[fs_journal] error writing journal block %zu\n", fs->journal_head);
+        return false;
+    }
+    fs->journal_head++;
+    fs->journal_sequence++;
+    memset(fs->journal_buffer.data, 0, BLOCK_SIZE);
+    if (fs->journal_head == fs->meta_data.journal_blocks) {
+        return fs_journal_checkpoint_locked(fs);
+    }
+    return true;
+}
+
+/**
+ * Checkpoint journaled metadata back to its home locations (journal lock
+ * held): write the inode table and the free bitmap in large batches, then
+ * advance the SuperBlock journal sequence so old records are never replayed.
+ **/
+bool fs_journal_checkpoint_locked(FileSystem *fs) {
+    pthread_mutex_lock(&fs->itable_lock);
+    bool table_written = disk_writev(fs->disk, 1, fs->meta_data.inode_blocks,
+                                     fs->inode_table->data) != DISK_FAILURE;
+    pthread_mutex_unlock(&fs->itable_lock);
+    if (!table_written || !fs_store_free_block_bitmap(fs)) {
+        error("[fs_journal] error writing checkpoint\n");
+        return false;
+    }
+    fs->journal_head = 0;
+    fs->meta_data.journal_sequence = fs->journal_sequence;
+    return fs_write_superblock(fs);
+}
+
+/**
+ * Replay the journal on top of the checkpointed inode table and bitmap at
+ * mount.  Records are applied in sequence order until the chain breaks (bad
+ * magic, gap, or checksum), free counts are rebuilt from the resulting
+ * bitmap, and a checkpoint folds everything back into the home locations.
+ * Applying a record twice is harmless: bitmap deltas are idempotent bit
+ * operations and inode records carry full contents.
+ **/
+void fs_journal_replay(FileSystem *fs) {
+    Block blk;
+    size_t base = fs_journal_base(&fs->meta_data);
+    uint32_t expected = fs->meta_data.journal_sequence;
+
+    for (size_t h = 0; h < fs->meta_data.journal_blocks; h++) {
+        if (disk_read(fs->disk, base + h, blk.data) == DISK_FAILURE) {
+            break;
+        }
+        JournalBlock *journal = (JournalBlock*)blk.data;
+        if (journal->magic != JOURNAL_MAGIC || journal->sequence != expected ||
+            journal->count > JOURNAL_ENTRIES ||
+            journal->checksum != checksum_block((char*)journal->entries, sizeof(journal->entries))) {
+            break;
+        }
+        for (uint32_t e = 0; e < journal->count; e++) {
+            JournalEntry *entry = &journal->entries[e];
+            switch (entry->type) {
+            case JOURNAL_ENTRY_INODE:
+                if (entry->number < fs->meta_data.inodes) {
+                    fs->inode_table[entry->number / INODES_PER_BLOCK]
+                        .inodes[entry->number % INODES_PER_BLOCK] = entry->inode;
+                }
+                break;
+            case JOURNAL_ENTRY_ALLOC:
+                if (entry->number < fs->meta_data.blocks) {
+                    fs->free_blocks[entry->number / 64] &= ~(1ULL << (entry->number % 64));
+                }
+                break;
+            case JOURNAL_ENTRY_FREE:
+                if (entry->number < fs->meta_data.blocks) {
+                    fs->free_blocks[entry->number / 64] |= 1ULL << (entry->number % 64);
+                }
+                break;
+            }
+        }
+        expected++;
+    }
+    fs->journal_sequence = expected;
+    fs->journal_head = 0;
+
+    /* Rebuild the free counts from the replayed bitmap */
+    fs->free_block_count = 0;
+    memset(fs->group_free, 0, fs->group_count * sizeof(size_t));
+    for (size_t w = 0; w < (fs->meta_data.blocks + 63) / 64; w++) {
+        size_t free = __builtin_popcountll(fs->free_blocks[w]);
+        fs->free_block_count += free;
+        fs->group_free[(w * 64) / fs->group_blocks] += free;
+    }
+
+    fs_journal_checkpoint_locked(fs);
 }
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,341 @@
+/* sfsdefrag.c: SimpleFS offline defragmenter
+ *
+ * Walks the inode table of an unmounted image and rewrites each fragmented
+ * file's blocks into one contiguous run of free blocks, updating the direct
+ * pointers and the indirect block (merging v2 extent records) along the way.
+ * Files are only moved when a large enough free run exists, so the tool is
+ * safe to run on a nearly full image; rerunning it converges as moves open
+ * up space.  Fragmentation metrics are reported before and after.
+ */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Structures */
+
+typedef struct FileMap FileMap;
+struct FileMap {
+    uint32_t   *slots;          /* Physical block per logical block (0 = hole) */
+    size_t      count;          /* Number of logical blocks */
+    size_t      allocated;      /* Number of real (non-hole) blocks */
+};
+
+/* Prototypes */
+
+bool    map_load(FileSystem *fs, Inode *node, FileMap *map);
+size_t  map_fragments(FileMap *map);
+void    bitmap_reserve(FileSystem *fs, size_t block);
+void    bitmap_release(FileSystem *fs, size_t block);
+ssize_t find_free_run(FileSystem *fs, size_t length);
+bool    defragment_file(FileSystem *fs, size_t inode_number, Inode *node, FileMap *map, bool *lengths_dirty);
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <diskfile> <nblocks>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Disk *disk = disk_open(argv[1], atoi(argv[2]));
+    if (!disk) {
+        return EXIT_FAILURE;
+    }
+
+    FileSystem fs = {0};
+    if (!fs_mount(&fs, disk)) {
+        fprintf(stderr, "%s: mount failed\n", argv[1]);
+        disk_close(disk);
+        return EXIT_FAILURE;
+    }
+
+    size_t files = 0, fragmented = 0, moved = 0, skipped = 0;
+    size_t fragments_before = 0, fragments_after = 0, blocks_moved = 0;
+    bool   lengths_dirty = false;
+
+    for (size_t i = 0; i < fs.meta_data.inodes; i++) {
+        Inode node;
+        if (!fs_load_inode(&fs, i, &node) || !node.valid) {
+            continue;
+        }
+
+        FileMap map;
+        if (!map_load(&fs, &node, &map)) {
+            fprintf(stderr, "inode %zu: unreadable, skipping\n", i);
+            continue;
+        }
+        files++;
+
+        size_t fragments = map_fragments(&map);
+        fragments_before += fragments;
+        if (fragments <= 1) {
+            fragments_after += fragments;
+            free(map.slots);
+            continue;
+        }
+        fragmented++;
+
+        if (defragment_file(&fs, i, &node, &map, &lengths_dirty)) {
+            moved++;
+            blocks_moved += map.allocated;
+            fragments_after += 1;
+        } else {
+            skipped++;
+            fragments_after += fragments;
+        }
+        free(map.slots);
+    }
+
+    /* Moves carry their lengths and checksum entries along */
+    if (lengths_dirty) {
+        size_t lengths_blocks = fs.meta_data.compression ?
+            ((size_t)fs.meta_data.blocks * sizeof(uint16_t) + BLOCK_SIZE - 1) / BLOCK_SIZE : 0;
+        if (lengths_blocks > 0) {
+            disk_writev(disk, 1 + fs.meta_data.inode_blocks + fs.meta_data.bitmap_blocks,
+                        lengths_blocks, (char*)fs.block_lengths);
+        }
+        if (fs.meta_data.checksums) {
+            size_t checksum_blocks = ((size_t)fs.meta_data.blocks * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            disk_writev(disk, 1 + fs.meta_data.inode_blocks + fs.meta_data.bitmap_blocks + lengths_blocks,
+                        checksum_blocks, (char*)fs.block_checksums);
+        }
+    }
+
+    printf("%zu files scanned, %zu fragmented\n", files, fragmented);
+    printf("fragments: %zu before, %zu after\n", fragments_before, fragments_after);
+    printf("relocated %zu files (%zu blocks)", moved, blocks_moved);
+    if (skipped) {
+        printf(", skipped %zu (no contiguous free run)", skipped);
+    }
+    printf("\n");
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+/* Internal Functions */
+
+/**
+ * Load the logical-to-physical block map of an Inode: the direct pointers
+ * followed by the indirect region (v2 extent records expanded in order, with
+ * hole records contributing zero slots; v1 pointer blocks copied as-is).
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       node    Pointer to Inode to map.
+ * @param       map     Output FileMap (slots owned by caller on success).
+ *
+ * @return      Whether or not the map was loaded.
+ **/
+bool    map_load(FileSystem *fs, Inode *node, FileMap *map) {
+    Block indirect;
+    size_t capacity = POINTERS_PER_INODE;
+
+    if (node->indirect != 0) {
+        if (disk_read(fs->disk, node->indirect, indirect.data) == DISK_FAILURE) {
+            return false;
+        }
+        if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+            for (size_t e = 0; e < EXTENTS_PER_BLOCK && indirect.extents[e].length; e++) {
+                capacity += indirect.extents[e].length;
+            }
+        } else {
+            capacity += POINTERS_PER_BLOCK;
+        }
+    }
+
+    map->slots = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (map->slots == NULL) {
+        return false;
+    }
+    map->count = 0;
+    map->allocated = 0;
+
+    for (size_t d = 0; d < POINTERS_PER_INODE; d++) {
+        map->slots[map->count++] = node->direct[d];
+    }
+    if (node->indirect != 0) {
+        if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+            for (size_t e = 0; e < EXTENTS_PER_BLOCK && indirect.extents[e].length; e++) {
+                for (uint32_t b = 0; b < indirect.extents[e].length; b++) {
+                    map->slots[map->count++] = indirect.extents[e].start ?
+                        indirect.extents[e].start + b : 0;
+                }
+            }
+        } else {
+            for (size_t p = 0; p < POINTERS_PER_BLOCK; p++) {
+                map->slots[map->count++] = indirect.pointers[p];
+            }
+        }
+    }
+
+    /* Trim trailing holes and count the real blocks */
+    while (map->count > 0 && map->slots[map->count - 1] == 0) {
+        map->count--;
+    }
+    for (size_t i = 0; i < map->count; i++) {
+        if (map->slots[i] != 0) {
+            map->allocated++;
+        }
+    }
+    return true;
+}
+
+/**
+ * Count the contiguous physical runs a reader crosses when scanning the file
+ * in logical order (holes cost nothing and do not break a run).
+ **/
+size_t  map_fragments(FileMap *map) {
+    size_t fragments = 0;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < map->count; i++) {
+        if (map->slots[i] == 0) {
+            continue;
+        }
+        if (previous == 0 || map->slots[i] != previous + 1) {
+            fragments++;
+        }
+        previous = map->slots[i];
+    }
+    return fragments;
+}
+
+/**
+ * Mark a block in use in the mounted bitmap, keeping the free counts that
+ * fs_unmount persists consistent.
+ **/
+void    bitmap_reserve(FileSystem *fs, size_t block) {
+    fs->free_blocks[block / 64] &= ~(1ULL << (block % 64));
+    fs->group_free[block / fs->group_blocks]--;
+    fs->free_block_count--;
+}
+
+/**
+ * Return a block to the mounted bitmap.
+ **/
+void    bitmap_release(FileSystem *fs, size_t block) {
+    fs->free_blocks[block / 64] |= 1ULL << (block % 64);
+    fs->group_free[block / fs->group_blocks]++;
+    fs->free_block_count++;
+}
+
+/**
+ * Find a contiguous run of free blocks.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       length  Number of consecutive free blocks required.
+ *
+ * @return      First block of the run (-1 if no such run exists).
+ **/
+ssize_t find_free_run(FileSystem *fs, size_t length) {
+    size_t run = 0;
+    for (size_t b = 1; b < fs->meta_data.blocks; b++) {
+        run = fs_block_is_free(fs, b) ? run + 1 : 0;
+        if (run == length) {
+            return b - length + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Rewrite one file's blocks into a single contiguous run by doing the
+ * following:
+ *
+ *  1. Find a free run large enough for every allocated block.
+ *
+ *  2. Copy each block into the run in logical order, carrying its compressed
+ *  length entry on compressed images, and swap the bitmap bits.
+ *
+ *  3. Rebuild the direct pointers and the indirect block (one merged extent
+ *  per hole-separated run on v2 images) and save the Inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode number being defragmented.
+ * @param       node            Pointer to loaded Inode.
+ * @param       map             Logical-to-physical map of the file.
+ * @param       lengths_dirty   Set when lengths map entries were moved.
+ *
+ * @return      Whether or not the file was relocated.
+ **/
+bool    defragment_file(FileSystem *fs, size_t inode_number, Inode *node, FileMap *map, bool *lengths_dirty) {
+    ssize_t run = find_free_run(fs, map->allocated);
+    if (run < 0) {
+        return false;
+    }
+
+    /* Copy everything first: a failure here leaves the bitmap and the
+     * on-disk pointers untouched, so the file is still intact in place */
+    char data[BLOCK_SIZE];
+    uint32_t next = run;
+    for (size_t i = 0; i < map->count; i++) {
+        if (map->slots[i] == 0) {
+            continue;
+        }
+        if (disk_read(fs->disk, map->slots[i], data) == DISK_FAILURE ||
+            disk_write(fs->disk, next, data) == DISK_FAILURE) {
+            fprintf(stderr, "inode %zu: copy failed, aborting move\n", inode_number);
+            return false;
+        }
+        if (fs->meta_data.compression) {
+            fs->block_lengths[next] = fs->block_lengths[map->slots[i]];
+            *lengths_dirty = true;
+        }
+        if (fs->meta_data.checksums) {
+            fs->block_checksums[next] = fs->block_checksums[map->slots[i]];
+            *lengths_dirty = true;
+        }
+        next++;
+    }
+
+    next = run;
+    for (size_t i = 0; i < map->count; i++) {
+        if (map->slots[i] == 0) {
+            continue;
+        }
+        bitmap_reserve(fs, next);
+        bitmap_release(fs, map->slots[i]);
+        map->slots[i] = next++;
+    }
+
+    for (size_t d = 0; d < POINTERS_PER_INODE; d++) {
+        node->direct[d] = d < map->count ? map->slots[d] : 0;
+    }
+
+    if (node->indirect != 0) {
+        Block indirect;
+        memset(indirect.data, 0, BLOCK_SIZE);
+        if (fs->meta_data.magic_number == MAGIC_NUMBER_V2) {
+            size_t e = 0;
+            for (size_t i = POINTERS_PER_INODE; i < map->count; i++) {
+                if (e > 0 && map->slots[i] != 0 &&
+                    indirect.extents[e - 1].start != 0 &&
+                    indirect.extents[e - 1].start + indirect.extents[e - 1].length == map->slots[i]) {
+                    indirect.extents[e - 1].length++;
+                } else if (e > 0 && map->slots[i] == 0 && indirect.extents[e - 1].start == 0) {
+                    indirect.extents[e - 1].length++;
+                } else {
+                    indirect.extents[e].start  = map->slots[i];
+                    indirect.extents[e].length = 1;
+                    e++;
+                }
+            }
+        } else {
+            for (size_t i = POINTERS_PER_INODE; i < map->count; i++) {
+                indirect.pointers[i - POINTERS_PER_INODE] = map->slots[i];
+            }
+        }
+        if (disk_write(fs->disk, node->indirect, indirect.data) == DISK_FAILURE) {
+            fprintf(stderr, "inode %zu: indirect write failed\n", inode_number);
+            return false;
+        }
+    }
+
+    return fs_save_inode(fs, inode_number, node);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -1,16 +1,24 @@
 /* sfssh.c: SimpleFS shell */
 
+#include "sfs/checksum.h"
+#include "sfs/compress.h"
 #include "sfs/disk.h"
 #include "sfs/fs.h"
+#include "sfs/stats.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Macros */
 
 #define streq(a, b)	(strcmp((a), (b)) == 0)
+#define COPY_CHUNK	(4*BUFSIZ)
 
 /* Command Prototyes */
 
@@ -20,21 +28,32 @@ void do_mount(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_create(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_remove(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_stat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_blocks(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_grow(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_verify(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyout(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_cat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 
 /* Utility Prototypes */
 
 bool copyout(FileSystem *fs, size_t inode_number, const char *path);
 bool copyin(FileSystem *fs, const char *path, size_t inode_number);
+bool execute(Disk *disk, FileSystem *fs, char *line);
+int  run_script(Disk *disk, FileSystem *fs, const char *path);
+
+/* Globals */
+
+size_t copy_total = 0;  /* Bytes moved by copyin/copyout (for --script summary) */
 
 /* Main Execution */
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-	fprintf(stderr, "Usage: %s <diskfile> <nblocks>\n", argv[0]);
+    bool batch = argc == 5 && streq(argv[3], "--script");
+    if (argc != 3 && !batch) {
+	fprintf(stderr, "Usage: %s <diskfile> <nblocks> [--script <file>]\n", argv[0]);
 	return EXIT_FAILURE;
     }
 
@@ -42,55 +61,152 @@ int main(int argc, char *argv[]) {
     if (!disk) {
     	return EXIT_FAILURE;
     }
+    disk_async_setup(disk, DISK_ASYNC_WORKERS);
+
+    /* SFS_TRACE=<path> captures every fs-level call for bin/sfsreplay */
+    const char *trace_path = getenv("SFS_TRACE");
+    if (trace_path && !trace_begin(trace_path)) {
+        fprintf(stderr, "Unable to trace to %s\n", trace_path);
+    }
 
     FileSystem fs = {0};
-    while (true) {
-	char line[BUFSIZ], cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ];
-	fprintf(stderr, "sfs> ");
-	fflush(stderr);
-
-	if (fgets(line, BUFSIZ, stdin) == NULL) {
-	    break;
-	}
-
-	int args = sscanf(line, "%s %s %s", cmd, arg1, arg2);
-	if (args == 0) {
-	    continue;
-	}
-
-
-	if (streq(cmd, "debug")) {
-	    do_debug(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "format")) {
-	    do_format(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "mount")) {
-	    do_mount(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "create")) {
-	    do_create(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "remove")) {
-	    do_remove(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "stat")) {
-	    do_stat(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "copyout")) {
-	    do_copyout(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "cat")) {
-	    do_cat(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "copyin")) {
-	    do_copyin(disk, &fs, args, arg1, arg2);
-        } else if (streq(cmd, "help")) {
-	    do_help(disk, &fs, args, arg1, arg2);
-	} else if (streq(cmd, "exit") || streq(cmd, "quit")) {
-	    break;
-	} else {
-	    printf("Unknown command: %s", line);
-	    printf("Type 'help' for a list of commands.\n");
-	}
+    int status = EXIT_SUCCESS;
+    if (batch) {
+        status = run_script(disk, &fs, argv[4]);
+    } else {
+        while (true) {
+            char line[BUFSIZ];
+            fprintf(stderr, "sfs> ");
+            fflush(stderr);
+
+            if (fgets(line, BUFSIZ, stdin) == NULL) {
+                break;
+            }
+            if (!execute(disk, &fs, line)) {
+                break;
+            }
+        }
     }
 
     fs_unmount(&fs);
     assert(fs.disk == NULL);
     assert(fs.free_blocks == NULL);
     disk_close(disk);
+    trace_end();
+    return status;
+}
+
+/**
+ * Dispatch one command line (returns false on exit/quit).
+ **/
+bool execute(Disk *disk, FileSystem *fs, char *line) {
+    char cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ];
+    int args = sscanf(line, "%s %s %s", cmd, arg1, arg2);
+    if (args <= 0) {
+        return true;
+    }
+
+    if (streq(cmd, "debug")) {
+        do_debug(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "format")) {
+        do_format(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "mount")) {
+        do_mount(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "create")) {
+        do_create(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "remove")) {
+        do_remove(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "stat")) {
+        do_stat(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "blocks")) {
+        do_blocks(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "grow")) {
+        do_grow(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "verify")) {
+        do_verify(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "copyout")) {
+        do_copyout(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "cat")) {
+        do_cat(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "copyin")) {
+        do_copyin(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "stats")) {
+        do_stats(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "help")) {
+        do_help(disk, fs, args, arg1, arg2);
+    } else if (streq(cmd, "exit") || streq(cmd, "quit")) {
+        return false;
+    } else {
+        printf("Unknown command: %s", line);
+        printf("Type 'help' for a list of commands.\n");
+    }
+    return true;
+}
+
+/**
+ * Execute a command script by doing the following:
+ *
+ *  1. Read the whole command stream up front (no prompt).
+ *
+ *  2. Ask the kernel to start reading every copyin source file now
+ *  (POSIX_FADV_WILLNEED), so the host-side read of copyin N+1 overlaps the
+ *  fs_write of copyin N instead of running cold.
+ *
+ *  3. Dispatch the commands in order and report total copy throughput.
+ *
+ * @param       disk    Pointer to Disk structure.
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       path    Path to command script.
+ *
+ * @return      Exit status.
+ **/
+int run_script(Disk *disk, FileSystem *fs, const char *path) {
+    FILE *stream = fopen(path, "r");
+    if (!stream) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char  **lines  = NULL;
+    size_t  nlines = 0;
+    char    line[BUFSIZ];
+    while (fgets(line, BUFSIZ, stream)) {
+        char **grown = realloc(lines, (nlines + 1) * sizeof(char*));
+        if (grown == NULL) {
+            break;
+        }
+        lines = grown;
+        lines[nlines++] = strdup(line);
+    }
+    fclose(stream);
+
+    /* Warm upcoming copyin sources in the background */
+    for (size_t i = 0; i < nlines; i++) {
+        char cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ];
+        if (sscanf(lines[i], "%s %s %s", cmd, arg1, arg2) == 3 && streq(cmd, "copyin")) {
+            int fd = open(arg1, O_RDONLY);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+    }
+
+    uint64_t start = stats_time();
+    for (size_t i = 0; i < nlines; i++) {
+        if (!execute(disk, fs, lines[i])) {
+            break;
+        }
+    }
+    double elapsed = (stats_time() - start) / 1e9;
+    fprintf(stderr, "%zu commands, %zu bytes copied in %0.3f s (%0.1f MB/s)\n",
+            nlines, copy_total, elapsed,
+            elapsed > 0 ? copy_total / elapsed / (1 << 20) : 0.0);
+
+    for (size_t i = 0; i < nlines; i++) {
+        free(lines[i]);
+    }
+    free(lines);
     return EXIT_SUCCESS;
 }
 
@@ -105,12 +221,16 @@ void do_debug(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
 }
 
 void do_format(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
-    if (args != 1) {
-	printf("Usage: format\n");
+    if (args > 3 || (args == 3 && !streq(arg2, "compressed") &&
+                     !streq(arg2, "checksummed") && !streq(arg2, "journaled"))) {
+	printf("Usage: format [clusters] [compressed|checksummed|journaled]\n");
 	return;
     }
 
-    if (fs_format(fs, disk)) {
+    if (fs_format_journaled(fs, disk, args >= 2 ? atoi(arg1) : 1,
+                            args == 3 && streq(arg2, "compressed"),
+                            args == 3 && streq(arg2, "checksummed"),
+                            args == 3 && streq(arg2, "journaled"))) {
         printf("disk formatted.\n");
     } else {
         printf("format failed!\n");
@@ -173,6 +293,87 @@ void do_stat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_blocks(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: blocks <inode>\n");
+        return;
+    }
+
+    ssize_t inode_number = atoi(arg1);
+    ssize_t blocks       = fs_blocks(fs, inode_number);
+    if (blocks >= 0) {
+        printf("inode %ld has %ld blocks.\n", inode_number, blocks);
+    } else {
+        printf("blocks failed!\n");
+    }
+}
+
+void do_grow(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: grow <blocks>\n");
+        return;
+    }
+
+    size_t blocks = atoi(arg1);
+    if (fs_grow(fs, blocks)) {
+        printf("grew file system to %zu blocks.\n", blocks);
+    } else {
+        printf("grow failed!\n");
+    }
+}
+
+void do_verify(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+        printf("Usage: verify\n");
+        return;
+    }
+    if (!fs->meta_data.checksums) {
+        printf("image keeps no checksums!\n");
+        return;
+    }
+
+    /* Stream the whole image with large vectored reads; only blocks with a
+     * recorded checksum (i.e. written data blocks) are checked */
+    size_t batch = 64;
+    char *buffer = malloc(batch * BLOCK_SIZE);
+    if (buffer == NULL) {
+        printf("verify failed!\n");
+        return;
+    }
+    size_t checked = 0, mismatches = 0;
+    for (size_t b = 1; b < fs->meta_data.blocks; b += batch) {
+        size_t run = fs->meta_data.blocks - b < batch ? fs->meta_data.blocks - b : batch;
+        if (disk_readv(disk, b, run, buffer) == DISK_FAILURE) {
+            printf("verify failed!\n");
+            free(buffer);
+            return;
+        }
+        for (size_t i = 0; i < run; i++) {
+            uint32_t expected = fs->block_checksums[b + i];
+            if (expected == 0) {
+                continue;
+            }
+            checked++;
+            char *block = buffer + i * BLOCK_SIZE;
+            char  full[BLOCK_SIZE];
+            if (fs->meta_data.compression && fs->block_lengths[b + i] != 0) {
+                if (decompress_block(block, fs->block_lengths[b + i], full, BLOCK_SIZE) != BLOCK_SIZE) {
+                    printf("block %zu: corrupt compressed data\n", b + i);
+                    mismatches++;
+                    continue;
+                }
+                block = full;
+            }
+            if (checksum_block(block, BLOCK_SIZE) != expected) {
+                printf("block %zu: checksum mismatch\n", b + i);
+                mismatches++;
+            }
+        }
+    }
+    free(buffer);
+    printf("verified %zu blocks, %zu mismatches.\n", checked, mismatches);
+}
+
 void do_copyout(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     if (args != 3) {
         printf("Usage: copyout <inode> <file>\n");
@@ -206,17 +407,30 @@ void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+        printf("Usage: stats\n");
+        return;
+    }
+
+    stats_report(stdout);
+}
+
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     printf("Commands are:\n");
-    printf("    format\n");
+    printf("    format  [clusters] [compressed|checksummed|journaled]\n");
     printf("    mount\n");
     printf("    debug\n");
     printf("    create\n");
     printf("    remove  <inode>\n");
     printf("    cat     <inode>\n");
     printf("    stat    <inode>\n");
+    printf("    blocks  <inode>\n");
+    printf("    grow    <blocks>\n");
+    printf("    verify\n");
     printf("    copyin  <file> <inode>\n");
     printf("    copyout <inode> <file>\n");
+    printf("    stats\n");
     printf("    help\n");
     printf("    quit\n");
     printf("    exit\n");
@@ -225,54 +439,118 @@ void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
 /* Utility Functions */
 
 bool copyin(FileSystem *fs, const char *path, size_t inode_number) {
-    FILE *stream = fopen(path, "r");
-    if (!stream) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
         return false;
     }
 
-    char buffer[4*BUFSIZ] = {0};
-    size_t offset = 0;
-    while (true) {
-        ssize_t result = fread(buffer, 1, sizeof(buffer), stream);
-        if (result <= 0) {
-            break;
+    /* Map regular files and hand slices of the mapping straight to
+     * fs_write, skipping the intermediate copy through a stack buffer */
+    struct stat st;
+    char *mapped = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = NULL;
         }
-        ssize_t actual = fs_write(fs, inode_number, buffer, result, offset);
-        if (actual < 0) {
-            fprintf(stderr, "fs_write returned invalid result %ld\n", actual);
-            break;
+    }
+
+    size_t offset = 0;
+    if (mapped) {
+        while (offset < (size_t)st.st_size) {
+            size_t chunk = (size_t)st.st_size - offset;
+            if (chunk > COPY_CHUNK) {
+                chunk = COPY_CHUNK;
+            }
+            ssize_t actual = fs_write(fs, inode_number, mapped + offset, chunk, offset);
+            if (actual < 0) {
+                fprintf(stderr, "fs_write returned invalid result %ld\n", actual);
+                break;
+            }
+            offset += actual;
+            if ((size_t)actual != chunk) {
+                fprintf(stderr, "fs_write only wrote %ld bytes, not %zu bytes\n", actual, chunk);
+                break;
+            }
         }
-        offset += actual;
-        if (actual != result) {
-            fprintf(stderr, "fs_write only wrote %ld bytes, not %ld bytes\n", actual, result);
-            break;
+        munmap(mapped, st.st_size);
+    } else {
+        char buffer[COPY_CHUNK];
+        while (true) {
+            ssize_t result = read(fd, buffer, sizeof(buffer));
+            if (result <= 0) {
+                break;
+            }
+            ssize_t actual = fs_write(fs, inode_number, buffer, result, offset);
+            if (actual < 0) {
+                fprintf(stderr, "fs_write returned invalid result %ld\n", actual);
+                break;
+            }
+            offset += actual;
+            if (actual != result) {
+                fprintf(stderr, "fs_write only wrote %ld bytes, not %ld bytes\n", actual, result);
+                break;
+            }
         }
     }
+    copy_total += offset;
     printf("%lu bytes copied\n", offset);
-    fclose(stream);
+    close(fd);
     return true;
 }
 
 bool copyout(FileSystem *fs, size_t inode_number, const char *path) {
-    FILE *stream = fopen(path, "w");
-    if (!stream) {
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
         return false;
     }
 
-    char buffer[4*BUFSIZ] = {0};
+    /* Size regular destinations up front and let fs_read fill the mapping
+     * in place; pipes and devices (cat) keep the buffered path */
+    ssize_t size = fs_stat(fs, inode_number);
+    struct stat st;
+    char *mapped = NULL;
+    if (size > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        ftruncate(fd, size) == 0) {
+        mapped = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = NULL;
+        }
+    }
+
     size_t offset = 0;
-    while (true) {
-        ssize_t result = fs_read(fs, inode_number, buffer, sizeof(buffer), offset);
-        if (result <= 0) {
-            break;
+    if (mapped) {
+        while (offset < (size_t)size) {
+            size_t chunk = (size_t)size - offset;
+            if (chunk > COPY_CHUNK) {
+                chunk = COPY_CHUNK;
+            }
+            ssize_t result = fs_read(fs, inode_number, mapped + offset, chunk, offset);
+            if (result <= 0) {
+                break;
+            }
+            offset += result;
+        }
+        munmap(mapped, size);
+    } else {
+        char buffer[COPY_CHUNK];
+        while (true) {
+            ssize_t result = fs_read(fs, inode_number, buffer, sizeof(buffer), offset);
+            if (result <= 0) {
+                break;
+            }
+            if (write(fd, buffer, result) != result) {
+                fprintf(stderr, "Unable to write %ld bytes: %s\n", result, strerror(errno));
+                break;
+            }
+            offset += result;
         }
-        fwrite(buffer, 1, result, stream);
-        offset += result;
     }
+    copy_total += offset;
     printf("%lu bytes copied\n", offset);
-    fclose(stream);
+    close(fd);
     return true;
 }
 
@@ -6,7 +6,9 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <sys/wait.h>
 #include <unistd.h>
 
 /* Functions */
@@ -24,11 +26,11 @@ int test_00_fs_mount() {
     assert(fs_mount(&fs, disk));
     assert(fs.disk           == disk);
     assert(fs.free_blocks);
-    assert(fs.free_blocks[0] == false);
-    assert(fs.free_blocks[1] == false);
-    assert(fs.free_blocks[2] == false);
-    assert(fs.free_blocks[3] == true);
-    assert(fs.free_blocks[4] == true);
+    assert(fs_block_is_free(&fs, 0) == false);
+    assert(fs_block_is_free(&fs, 1) == false);
+    assert(fs_block_is_free(&fs, 2) == false);
+    assert(fs_block_is_free(&fs, 3) == true);
+    assert(fs_block_is_free(&fs, 4) == true);
 
     debug("Check mounting filesystem (already mounted)");
     assert(fs_mount(&fs, disk) == false);
@@ -43,26 +45,26 @@ int test_00_fs_mount() {
     assert(fs_mount(&fs, disk));
     assert(fs.disk           == disk);
     assert(fs.free_blocks);
-    assert(fs.free_blocks[0] == false);
-    assert(fs.free_blocks[1] == false);
-    assert(fs.free_blocks[2] == false);
-    assert(fs.free_blocks[3] == true);
-    assert(fs.free_blocks[4] == false);
-    assert(fs.free_blocks[5] == false);
-    assert(fs.free_blocks[6] == false);
-    assert(fs.free_blocks[7] == false);
-    assert(fs.free_blocks[8] == false);
-    assert(fs.free_blocks[9] == false);
-    assert(fs.free_blocks[10] == false);
-    assert(fs.free_blocks[11] == false);
-    assert(fs.free_blocks[12] == false);
-    assert(fs.free_blocks[13] == false);
-    assert(fs.free_blocks[14] == false);
-    assert(fs.free_blocks[15] == true);
-    assert(fs.free_blocks[16] == true);
-    assert(fs.free_blocks[17] == true);
-    assert(fs.free_blocks[18] == true);
-    assert(fs.free_blocks[19] == true);
+    assert(fs_block_is_free(&fs, 0) == false);
+    assert(fs_block_is_free(&fs, 1) == false);
+    assert(fs_block_is_free(&fs, 2) == false);
+    assert(fs_block_is_free(&fs, 3) == true);
+    assert(fs_block_is_free(&fs, 4) == false);
+    assert(fs_block_is_free(&fs, 5) == false);
+    assert(fs_block_is_free(&fs, 6) == false);
+    assert(fs_block_is_free(&fs, 7) == false);
+    assert(fs_block_is_free(&fs, 8) == false);
+    assert(fs_block_is_free(&fs, 9) == false);
+    assert(fs_block_is_free(&fs, 10) == false);
+    assert(fs_block_is_free(&fs, 11) == false);
+    assert(fs_block_is_free(&fs, 12) == false);
+    assert(fs_block_is_free(&fs, 13) == false);
+    assert(fs_block_is_free(&fs, 14) == false);
+    assert(fs_block_is_free(&fs, 15) == true);
+    assert(fs_block_is_free(&fs, 16) == true);
+    assert(fs_block_is_free(&fs, 17) == true);
+    assert(fs_block_is_free(&fs, 18) == true);
+    assert(fs_block_is_free(&fs, 19) == true);
 
     debug("Check mounting filesystem (already mounted)");
     assert(fs_mount(&fs, disk) == false);
@@ -115,14 +117,14 @@ int test_02_fs_remove() {
 
     debug("Check removing inode 2");
     assert(fs_remove(&fs, 2));
-    assert(fs.free_blocks[4]);
-    assert(fs.free_blocks[5]);
-    assert(fs.free_blocks[6]);
-    assert(fs.free_blocks[7]);
-    assert(fs.free_blocks[8]);
-    assert(fs.free_blocks[9]);
-    assert(fs.free_blocks[13]);
-    assert(fs.free_blocks[14]);
+    assert(fs_block_is_free(&fs, 4));
+    assert(fs_block_is_free(&fs, 5));
+    assert(fs_block_is_free(&fs, 6));
+    assert(fs_block_is_free(&fs, 7));
+    assert(fs_block_is_free(&fs, 8));
+    assert(fs_block_is_free(&fs, 9));
+    assert(fs_block_is_free(&fs, 13));
+    assert(fs_block_is_free(&fs, 14));
 
     Block block;
     assert(disk_read(fs.disk, 1, block.data) != DISK_FAILURE);
@@ -164,6 +166,156 @@ int test_03_fs_stat() {
     return EXIT_SUCCESS;
 }
 
+int test_04_fs_v2_extents() {
+    Disk *disk = disk_open("data/image.unit", 100);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check formatting v2 filesystem");
+    assert(fs_format(&fs, disk));
+    assert(fs_mount(&fs, disk));
+    assert(fs.meta_data.magic_number == MAGIC_NUMBER_V2);
+
+    debug("Check writing past the direct pointers");
+    ssize_t inode = fs_create(&fs);
+    assert(inode >= 0);
+    char buffer[BLOCK_SIZE];
+    for (size_t b = 0; b < POINTERS_PER_INODE + 10; b++) {
+        memset(buffer, 'a' + b % 26, BLOCK_SIZE);
+        assert(fs_write(&fs, inode, buffer, BLOCK_SIZE, b * BLOCK_SIZE) == BLOCK_SIZE);
+    }
+
+    debug("Check writing past a hole");
+    memset(buffer, '!', BLOCK_SIZE);
+    assert(fs_write(&fs, inode, buffer, BLOCK_SIZE, 30 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_stat(&fs, inode) == 31 * BLOCK_SIZE);
+
+    debug("Check reading holes as zeros");
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 20 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+
+    debug("Check contents after remounting");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    for (size_t b = 0; b < POINTERS_PER_INODE + 10; b++) {
+        assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, b * BLOCK_SIZE) == BLOCK_SIZE);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(buffer[i] == 'a' + (char)(b % 26));
+        }
+    }
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 25 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 30 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(buffer[i] == '!');
+    }
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_05_fs_cluster() {
+    Disk *disk = disk_open("data/image.unit", 400);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check formatting clustered filesystem");
+    assert(fs_format_clustered(&fs, disk, 16));
+    assert(fs_mount(&fs, disk));
+
+    debug("Check dirtying and freeing the data region");
+    char buffer[BLOCK_SIZE];
+    memset(buffer, 0xdd, BLOCK_SIZE);
+    ssize_t victim = fs_create(&fs);
+    assert(victim >= 0);
+    for (size_t b = 0; b < 64; b++) {
+        assert(fs_write(&fs, victim, buffer, BLOCK_SIZE, b * BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    assert(fs_remove(&fs, victim));
+
+    debug("Check sparse writes into clusters");
+    ssize_t inode = fs_create(&fs);
+    assert(inode >= 0);
+    memset(buffer, 0xaa, BLOCK_SIZE);
+    assert(fs_write(&fs, inode, buffer, BLOCK_SIZE,  6 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_write(&fs, inode, buffer, BLOCK_SIZE, 22 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_write(&fs, inode, buffer, BLOCK_SIZE, 37 * BLOCK_SIZE) == BLOCK_SIZE);
+
+    debug("Check never-written cluster-tail block reads zeros");
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 30 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+
+    debug("Check written blocks after remounting");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 22 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert((unsigned char)buffer[i] == 0xaa);
+    }
+    assert(fs_read(&fs, inode, buffer, BLOCK_SIZE, 30 * BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_06_fs_journal_replay() {
+    Disk *disk = disk_open("data/image.unit", 400);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check formatting journaled filesystem");
+    assert(fs_format_journaled(&fs, disk, 1, false, false, true));
+    disk_close(disk);
+
+    debug("Check crashing without unmounting");
+    pid_t pid = fork();
+    if (pid == 0) {
+        Disk *d = disk_open("data/image.unit", 400);
+        FileSystem child = {0};
+        assert(fs_mount(&child, d));
+        char buffer[BLOCK_SIZE];
+        memset(buffer, 0xab, BLOCK_SIZE);
+        for (int i = 0; i < 10; i++) {
+            ssize_t inode = fs_create(&child);
+            assert(inode >= 0);
+            assert(fs_write(&child, inode, buffer, BLOCK_SIZE, 0) == BLOCK_SIZE);
+        }
+        disk_sync(d);
+        _exit(EXIT_SUCCESS);    /* no unmount: only the journal has the metadata */
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    debug("Check replaying journal on remount");
+    disk = disk_open("data/image.unit", 400);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < 10; i++) {
+        assert(fs_stat(&fs, i) == BLOCK_SIZE);
+        assert(fs_read(&fs, i, buffer, BLOCK_SIZE, 0) == BLOCK_SIZE);
+        for (size_t b = 0; b < BLOCK_SIZE; b++) {
+            assert((unsigned char)buffer[b] == 0xab);
+        }
+    }
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
 /* Main execution */
 
 int main(int argc, char *argv[]) {
@@ -174,6 +326,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    1. Test fs_create\n");
         fprintf(stderr, "    2. Test fs_remove\n");
         fprintf(stderr, "    3. Test fs_stat\n");
+        fprintf(stderr, "    4. Test v2 extents\n");
+        fprintf(stderr, "    5. Test clusters\n");
+        fprintf(stderr, "    6. Test journal replay\n");
         return EXIT_FAILURE;
     }
 
@@ -187,6 +342,9 @@ int main(int argc, char *argv[]) {
         case 1:  status = test_01_fs_create(); break;
         case 2:  status = test_02_fs_remove(); break;
         case 3:  status = test_03_fs_stat(); break;
+        case 4:  status = test_04_fs_v2_extents(); break;
+        case 5:  status = test_05_fs_cluster(); break;
+        case 6:  status = test_06_fs_journal_replay(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 